@@ -33,6 +33,7 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
@@ -110,6 +111,11 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+			case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
 #ifdef UW
 	case SYS_write:
 		err = sys_write((int)tf->tf_a0,
@@ -117,6 +123,42 @@ syscall(struct trapframe *tf)
 				(int)tf->tf_a2,
 				(int *)(&retval));
 		break;
+	case SYS_readv:
+		err = sys_readv((int)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(int)tf->tf_a2,
+				(int *)(&retval));
+		break;
+	case SYS_writev:
+		err = sys_writev((int)tf->tf_a0,
+				 (userptr_t)tf->tf_a1,
+				 (int)tf->tf_a2,
+				 (int *)(&retval));
+		break;
+	case SYS_poll:
+		err = sys_poll((userptr_t)tf->tf_a0,
+			       (unsigned)tf->tf_a1,
+			       (int)tf->tf_a2,
+			       (int *)(&retval));
+		break;
+	case SYS_select:
+	{
+		/* The fifth argument is on the user stack. */
+		userptr_t timeout;
+
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &timeout,
+			     sizeof(timeout));
+		if (err) {
+			break;
+		}
+		err = sys_select((int)tf->tf_a0,
+				 (userptr_t)tf->tf_a1,
+				 (userptr_t)tf->tf_a2,
+				 (userptr_t)tf->tf_a3,
+				 timeout,
+				 (int *)(&retval));
+		break;
+	}
 	case SYS__exit:
 		sys__exit((int)tf->tf_a0);
 		/* sys__exit does not return, execution should not get here */
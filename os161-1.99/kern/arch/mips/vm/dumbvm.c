@@ -55,7 +55,7 @@
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_TICKET_INITIALIZER("stealmem_lock");
 
 #if OPT_A3
 
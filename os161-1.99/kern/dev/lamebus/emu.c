@@ -48,9 +48,12 @@
 #include <array.h>
 #include <uio.h>
 #include <synch.h>
+#include <clock.h>
+#include <vm.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <poll.h>
 #include <emufs.h>
 #include "autoconf.h"
 
@@ -259,6 +262,57 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 	return result;
 }
 
+/*
+ * Get a bounce buffer (EMU_MAXIO bytes of kernel memory) from the
+ * pool, waiting if they're all in use.
+ *
+ * Data for user-space I/O is staged in a bounce buffer, so that e_lock
+ * only needs to be held while talking to the device and not while
+ * copying to or from user memory, which might fault or be slow.
+ * Kernel-space I/O copies straight to or from the device buffer, since
+ * that can't fault.
+ */
+static
+void *
+emu_bounce_get(struct emu_softc *sc)
+{
+	unsigned i;
+
+	P(sc->e_bouncesem);
+	spinlock_acquire(&sc->e_bouncelock);
+	for (i=0; i<EMU_NBOUNCE; i++) {
+		if (!sc->e_bounceused[i]) {
+			sc->e_bounceused[i] = true;
+			spinlock_release(&sc->e_bouncelock);
+			return sc->e_bounce[i];
+		}
+	}
+	panic("emu%d: no free bounce buffer\n", sc->e_unit);
+	return NULL;
+}
+
+/*
+ * Give a bounce buffer back to the pool.
+ */
+static
+void
+emu_bounce_put(struct emu_softc *sc, void *buf)
+{
+	unsigned i;
+
+	spinlock_acquire(&sc->e_bouncelock);
+	for (i=0; i<EMU_NBOUNCE; i++) {
+		if (sc->e_bounce[i] == buf) {
+			KASSERT(sc->e_bounceused[i]);
+			sc->e_bounceused[i] = false;
+			spinlock_release(&sc->e_bouncelock);
+			V(sc->e_bouncesem);
+			return;
+		}
+	}
+	panic("emu%d: bogus bounce buffer %p\n", sc->e_unit, buf);
+}
+
 /*
  * Common code for read and readdir.
  */
@@ -267,9 +321,18 @@ int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
+	void *bounce;
+	uint32_t got;
+	off_t newoffset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(len <= EMU_MAXIO);
+
+	bounce = NULL;
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		bounce = emu_bounce_get(sc);
+	}
 
 	lock_acquire(sc->e_lock);
 
@@ -279,15 +342,29 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	emu_wreg(sc, REG_OPER, op);
 	result = emu_waitdone(sc);
 	if (result) {
+		lock_release(sc->e_lock);
 		goto out;
 	}
-	
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
 
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	got = emu_rreg(sc, REG_IOLEN);
+	newoffset = emu_rreg(sc, REG_OFFSET);
+
+	if (bounce == NULL) {
+		result = uiomove(sc->e_iobuf, got, uio);
+		lock_release(sc->e_lock);
+	}
+	else {
+		memcpy(bounce, sc->e_iobuf, got);
+		lock_release(sc->e_lock);
+		result = uiomove(bounce, got, uio);
+	}
+
+	uio->uio_offset = newoffset;
 
  out:
-	lock_release(sc->e_lock);
+	if (bounce != NULL) {
+		emu_bounce_put(sc, bounce);
+	}
 	return result;
 }
 
@@ -321,26 +398,49 @@ int
 emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	  struct uio *uio)
 {
+	void *bounce;
+	off_t offset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(len <= EMU_MAXIO);
 
-	lock_acquire(sc->e_lock);
+	offset = uio->uio_offset;
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	/* Get the data from user space before locking the device */
+	bounce = NULL;
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		bounce = emu_bounce_get(sc);
+		result = uiomove(bounce, len, uio);
+		if (result) {
+			emu_bounce_put(sc, bounce);
+			return result;
+		}
+	}
 
-	result = uiomove(sc->e_iobuf, len, uio);
-	if (result) {
-		goto out;
+	lock_acquire(sc->e_lock);
+
+	if (bounce == NULL) {
+		result = uiomove(sc->e_iobuf, len, uio);
+		if (result) {
+			goto out;
+		}
+	}
+	else {
+		memcpy(sc->e_iobuf, bounce, len);
 	}
 
+	emu_wreg(sc, REG_HANDLE, handle);
+	emu_wreg(sc, REG_IOLEN, len);
+	emu_wreg(sc, REG_OFFSET, offset);
 	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
 	result = emu_waitdone(sc);
 
  out:
 	lock_release(sc->e_lock);
+	if (bounce != NULL) {
+		emu_bounce_put(sc, bounce);
+	}
 	return result;
 }
 
@@ -389,6 +489,241 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 //
 ////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////
+//
+// Cache
+//
+// (See emufs.h.) These need ef_cachelock, except as noted.
+
+/*
+ * Throw away EV's cached pages overlapping [START, END), along with
+ * the page holding the end of the file, which will be wrong if the
+ * file has grown.
+ */
+static
+void
+emufs_cache_discard(struct emufs_fs *ef, struct emufs_vnode *ev,
+		    off_t start, off_t end)
+{
+	struct emufs_page *ep;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(ef->ef_cachelock));
+
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ep = &ef->ef_pages[i];
+		if (ep->ep_vn != ev) {
+			continue;
+		}
+		if ((ep->ep_offset < end && ep->ep_offset + PAGE_SIZE > start)
+		    || ep->ep_len < PAGE_SIZE) {
+			ep->ep_vn = NULL;
+			ep->ep_stamp = 0;
+		}
+	}
+}
+
+/*
+ * Throw away everything cached for EV. Call with EV's ev_lock (or
+ * from reclaim) but not ef_cachelock.
+ */
+static
+void
+emufs_cache_purge(struct emufs_fs *ef, struct emufs_vnode *ev)
+{
+	struct emufs_page *ep;
+	unsigned i;
+
+	lock_acquire(ef->ef_cachelock);
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ep = &ef->ef_pages[i];
+		if (ep->ep_vn == ev) {
+			ep->ep_vn = NULL;
+			ep->ep_stamp = 0;
+		}
+	}
+	lock_release(ef->ef_cachelock);
+
+	ev->ev_sizevalid = false;
+}
+
+/*
+ * Find a page to hold new data, recycling the least recently used.
+ */
+static
+int
+emufs_cache_newpage(struct emufs_fs *ef, struct emufs_page **ret)
+{
+	struct emufs_page *victim;
+	unsigned i;
+
+	victim = &ef->ef_pages[0];
+	for (i=1; i<EMUFS_NPAGES; i++) {
+		/* Unused entries have stamp 0, so get picked first */
+		if (ef->ef_pages[i].ep_stamp < victim->ep_stamp) {
+			victim = &ef->ef_pages[i];
+		}
+	}
+
+	victim->ep_vn = NULL;
+	victim->ep_stamp = 0;
+	if (victim->ep_data == NULL) {
+		victim->ep_data = kmalloc(PAGE_SIZE);
+		if (victim->ep_data == NULL) {
+			return ENOMEM;
+		}
+	}
+	*ret = victim;
+	return 0;
+}
+
+/*
+ * Look for the page of EV's file starting at OFFSET in the cache.
+ */
+static
+struct emufs_page *
+emufs_cache_findpage(struct emufs_fs *ef, struct emufs_vnode *ev,
+		     off_t offset)
+{
+	struct emufs_page *ep;
+	unsigned i;
+
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ep = &ef->ef_pages[i];
+		if (ep->ep_vn == ev && ep->ep_offset == offset) {
+			return ep;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read LEN bytes of EV's file at OFFSET into kernel buffer BUF.
+ * The host may hand back less than we asked for; keep going until
+ * we have it all or hit EOF. Returns the amount read in *GOT.
+ */
+static
+int
+emufs_fill(struct emufs_vnode *ev, void *buf, off_t offset, uint32_t len,
+	   uint32_t *got)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t oldresid;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, offset, UIO_READ);
+	while (ku.uio_resid > 0) {
+		oldresid = ku.uio_resid;
+		result = emu_read(ev->ev_emu, ev->ev_handle, ku.uio_resid,
+				  &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid == oldresid) {
+			/* EOF */
+			break;
+		}
+	}
+	*got = len - ku.uio_resid;
+	return 0;
+}
+
+/*
+ * Copy the page of EV's file starting at OFFSET into BUF (a bounce
+ * buffer), reading it from the host if it isn't cached. Returns the
+ * number of bytes put in BUF in *GOT; less than PAGE_SIZE means EOF.
+ * Call with EV's ev_lock held. ef_cachelock is only taken to look up
+ * and install pages, not across the host transfer.
+ *
+ * If the file is being read sequentially (OFFSET is the page where
+ * the last read left off, or the one after it), read ahead: fetch a
+ * whole EMU_MAXIO worth of pages with one transfer and cache them
+ * all. *GOT may then be more than PAGE_SIZE. A run of small
+ * sequential reads costs one trip to the host per EMU_MAXIO bytes
+ * rather than one per page.
+ */
+static
+int
+emufs_cache_getpage(struct emufs_fs *ef, struct emufs_vnode *ev,
+		    off_t offset, char *buf, uint32_t *got)
+{
+	struct emufs_page *ep;
+	uint32_t amt, len, k;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	lock_acquire(ef->ef_cachelock);
+	ef->ef_pageclock++;
+	ep = emufs_cache_findpage(ef, ev, offset);
+	if (ep != NULL) {
+		ep->ep_stamp = ef->ef_pageclock;
+		memcpy(buf, ep->ep_data, ep->ep_len);
+		*got = ep->ep_len;
+		lock_release(ef->ef_cachelock);
+		return 0;
+	}
+	lock_release(ef->ef_cachelock);
+
+	if (offset < ev->ev_readnext - ev->ev_readnext % PAGE_SIZE ||
+	    offset > ROUNDUP(ev->ev_readnext, PAGE_SIZE)) {
+		/* Random access; just get the one page */
+		amt = PAGE_SIZE;
+	}
+	else {
+		amt = EMU_MAXIO;
+	}
+
+	/*
+	 * No other thread can load or drop pages of EV while we hold
+	 * its ev_lock, so nothing can go stale while we're at the host.
+	 */
+	result = emufs_fill(ev, buf, offset, amt, &amt);
+	if (result) {
+		return result;
+	}
+	*got = amt;
+
+	lock_acquire(ef->ef_cachelock);
+	for (k = 0; k < EMU_MAXIO / PAGE_SIZE; k++) {
+		len = amt > k*PAGE_SIZE ? amt - k*PAGE_SIZE : 0;
+		if (len > PAGE_SIZE) {
+			len = PAGE_SIZE;
+		}
+		if (k > 0 && len == 0) {
+			/* Past EOF */
+			break;
+		}
+		if (emufs_cache_findpage(ef, ev, offset + k*PAGE_SIZE)
+		    != NULL) {
+			/* Already have it; the contents are the same */
+			continue;
+		}
+
+		if (emufs_cache_newpage(ef, &ep)) {
+			/* The caller has the data anyway; just don't cache */
+			break;
+		}
+		memcpy(ep->ep_data, buf + k*PAGE_SIZE, len);
+		ep->ep_vn = ev;
+		ep->ep_offset = offset + k*PAGE_SIZE;
+		ep->ep_len = len;
+		ep->ep_stamp = ef->ef_pageclock;
+		if (len < PAGE_SIZE) {
+			/* That's the end of the file */
+			break;
+		}
+	}
+	lock_release(ef->ef_cachelock);
+
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////
 //
 // vnode functions 
@@ -398,6 +733,7 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 
 static int emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 			   struct emufs_vnode **ret);
+static const struct vnode_ops emufs_dirops;
 
 /*
  * VOP_OPEN on files
@@ -414,11 +750,31 @@ emufs_open(struct vnode *v, int openflags)
 	 * to check that either.
 	 */
 
+	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	off_t size;
+	int result;
+
 	if (openflags & O_APPEND) {
 		return EUNIMP;
 	}
 
-	(void)v;
+	/*
+	 * Close-to-open consistency (see emufs.h): keep what's cached
+	 * unless the size on the host has changed.
+	 */
+	lock_acquire(ev->ev_lock);
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		lock_release(ev->ev_lock);
+		return result;
+	}
+	if (!ev->ev_sizevalid || ev->ev_size != size) {
+		emufs_cache_purge(ef, ev);
+		ev->ev_size = size;
+		ev->ev_sizevalid = true;
+	}
+	lock_release(ev->ev_lock);
 
 	return 0;
 }
@@ -471,6 +827,14 @@ emufs_reclaim(struct vnode *v)
 	unsigned ix, i, num;
 	int result;
 
+	/*
+	 * Drop the vnode's cached pages first, as the cache lock comes
+	 * before e_lock. Nobody can be using them: the only way to get
+	 * at the vnode is through its handle, which nobody else has,
+	 * and if we end up not reclaiming it they'll just be reread.
+	 */
+	emufs_cache_purge(ef, ev);
+
 	/*
 	 * Need both of these locks, e_lock to protect the device
 	 * and vfs_biglock to protect the fs-related material.
@@ -479,11 +843,21 @@ emufs_reclaim(struct vnode *v)
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
 
-	if (ev->ev_v.vn_refcount != 1) {
+	/*
+	 * Make sure nobody picked the vnode up (in emufs_loadvnode,
+	 * which also holds vfs_biglock) since VOP_DECREF decided to
+	 * reclaim it. If so, just drop the reference we were given.
+	 */
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount != 1) {
+		KASSERT(v->vn_refcount > 1);
+		v->vn_refcount--;
+		spinlock_release(&v->vn_countlock);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	spinlock_release(&v->vn_countlock);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
@@ -515,44 +889,71 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	lock_destroy(ev->ev_lock);
 	kfree(ev);
 	return 0;
 }
 
 /*
  * VOP_READ
+ *
+ * Reads come out of the page cache, which is filled from the host a
+ * page at a time. The data is copied out of the cache into a bounce
+ * buffer, and only copied to the caller once no locks are held.
  */
 static
 int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
-	size_t oldresid;
-	int result;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	char *buf;
+	uint32_t pageoff, got, amt;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	buf = emu_bounce_get(ev->ev_emu);
+
 	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
+		pageoff = uio->uio_offset % PAGE_SIZE;
+
+		lock_acquire(ev->ev_lock);
+		result = emufs_cache_getpage(ef, ev,
+					     uio->uio_offset - pageoff,
+					     buf, &got);
+		if (result) {
+			lock_release(ev->ev_lock);
+			break;
+		}
+
+		amt = got > pageoff ? got - pageoff : 0;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
 		}
 
-		oldresid = uio->uio_resid;
+		/* Remember where to expect the next sequential read */
+		ev->ev_readnext = uio->uio_offset + amt;
+		lock_release(ev->ev_lock);
+
+		if (amt == 0) {
+			/* nothing here - EOF */
+			break;
+		}
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		result = uiomove(buf + pageoff, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
-		
-		if (uio->uio_resid == oldresid) {
-			/* nothing read - EOF */
+
+		if (got % PAGE_SIZE != 0) {
+			/* that was the last page */
 			break;
 		}
 	}
 
-	return 0;
+	emu_bounce_put(ev->ev_emu, buf);
+	return result;
 }
 
 /*
@@ -577,38 +978,60 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_WRITE
+ *
+ * Writes go straight through to the host; afterwards the cached
+ * pages they touched are dropped and the cached size is updated.
+ * Each chunk is copied in from the caller before locking the vnode.
  */
 static
 int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
 	uint32_t amt;
-	size_t oldresid;
-	int result;
+	off_t start;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	buf = emu_bounce_get(ev->ev_emu);
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
 			amt = EMU_MAXIO;
 		}
 
-		oldresid = uio->uio_resid;
-
-		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
+		start = uio->uio_offset;
+		result = uiomove(buf, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
-		if (uio->uio_resid == oldresid) {
-			/* nothing written...? */
+		lock_acquire(ev->ev_lock);
+		uio_kinit(&iov, &ku, buf, amt, start, UIO_WRITE);
+		result = emu_write(ev->ev_emu, ev->ev_handle, amt, &ku);
+		if (result) {
+			/* Not sure how much got written; forget everything */
+			emufs_cache_purge(ef, ev);
+			lock_release(ev->ev_lock);
 			break;
 		}
+		lock_acquire(ef->ef_cachelock);
+		emufs_cache_discard(ef, ev, start, start + amt);
+		lock_release(ef->ef_cachelock);
+		if (ev->ev_sizevalid && start + amt > ev->ev_size) {
+			ev->ev_size = start + amt;
+		}
+		lock_release(ev->ev_lock);
 	}
 
-	return 0;
+	emu_bounce_put(ev->ev_emu, buf);
+	return result;
 }
 
 /*
@@ -629,6 +1052,24 @@ emufs_ioctl(struct vnode *v, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * VOP_POLL
+ */
+static
+int
+emufs_poll(struct vnode *v, int events, struct pollwait *pw, int *revents)
+{
+	/*
+	 * Host files never block.
+	 */
+
+	(void)v;
+	(void)pw;
+
+	*revents = poll_alwaysready(events);
+	return 0;
+}
+
 /*
  * VOP_STAT
  */
@@ -641,10 +1082,18 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
-	if (result) {
-		return result;
+	/* The size comes from the cache if we have it */
+	lock_acquire(ev->ev_lock);
+	if (!ev->ev_sizevalid) {
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			lock_release(ev->ev_lock);
+			return result;
+		}
+		ev->ev_sizevalid = true;
 	}
+	statbuf->st_size = ev->ev_size;
+	lock_release(ev->ev_lock);
 
 	result = VOP_GETTYPE(v, &statbuf->st_mode);
 	if (result) {
@@ -717,63 +1166,206 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	int result;
+
+	lock_acquire(ev->ev_lock);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	emufs_cache_purge(ef, ev);
+	if (result == 0) {
+		ev->ev_size = len;
+		ev->ev_sizevalid = true;
+	}
+	lock_release(ev->ev_lock);
+
+	return result;
 }
 
 /*
- * VOP_CREAT
+ * Open NAME in DIR on the host. The name cache keeps host handles
+ * open, so if the host runs out of them, empty our part of the cache
+ * and try again.
  */
 static
 int
-emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
-	    struct vnode **ret)
+emufs_hostopen(struct vnode *dir, const char *name, bool create, bool excl,
+	       mode_t mode, uint32_t *handle, int *isdir)
+{
+	struct emufs_vnode *ev = dir->vn_data;
+	int result;
+
+	result = emu_open(ev->ev_emu, ev->ev_handle, name, create, excl, mode,
+			  handle, isdir);
+	if (result == ENFILE) {
+		vfs_ncache_purgefs(dir->vn_fs);
+		result = emu_open(ev->ev_emu, ev->ev_handle, name, create,
+				  excl, mode, handle, isdir);
+	}
+	return result;
+}
+
+/*
+ * Open NAME in DIR on the host and load a vnode for it, and remember
+ * it in the name cache.
+ */
+static
+int
+emufs_openname(struct vnode *dir, const char *name, bool create, bool excl,
+	       mode_t mode, struct emufs_vnode **ret)
 {
 	struct emufs_vnode *ev = dir->vn_data;
 	struct emufs_fs *ef = dir->vn_fs->fs_data;
-	struct emufs_vnode *newguy;
 	uint32_t handle;
+	uint32_t nsecs;
+	time_t now;
 	int result;
 	int isdir;
 
-	result = emu_open(ev->ev_emu, ev->ev_handle, name, true, excl, mode,
-			  &handle, &isdir);
+	result = emufs_hostopen(dir, name, create, excl, mode,
+				&handle, &isdir);
 	if (result) {
 		return result;
 	}
 
-	result = emufs_loadvnode(ef, handle, isdir, &newguy);
+	result = emufs_loadvnode(ef, handle, isdir, ret);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
 		return result;
 	}
 
-	*ret = &newguy->ev_v;
+	gettime(&now, &nsecs);
+	lock_acquire((*ret)->ev_lock);
+	(*ret)->ev_looktime = now;
+	lock_release((*ret)->ev_lock);
+
+	vfs_ncache_enter(dir, name, &(*ret)->ev_v);
 	return 0;
 }
 
 /*
- * VOP_LOOKUP
+ * Check that CACHED, which the name cache says is NAME in DIR, still
+ * is. Entries younger than EMUFS_LOOKUP_TTL are trusted. Older ones
+ * are checked by opening the name again on the host: if it's gone,
+ * the entry is dropped; if it's the same kind of object with the
+ * same size, we assume it's the same file and keep the cached vnode
+ * (and its cached pages); otherwise the new handle replaces it.
+ * Consumes the reference to CACHED.
  */
 static
 int
-emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
+emufs_revalidate(struct vnode *dir, const char *name, struct vnode *cached,
+		 struct vnode **ret)
 {
-	struct emufs_vnode *ev = dir->vn_data;
+	struct emufs_vnode *ev = cached->vn_data;
 	struct emufs_fs *ef = dir->vn_fs->fs_data;
 	struct emufs_vnode *newguy;
 	uint32_t handle;
-	int result;
-	int isdir;
+	uint32_t nsecs;
+	off_t oldsize, newsize;
+	time_t now;
+	int isdir, result;
+	bool same;
+
+	gettime(&now, &nsecs);
+
+	lock_acquire(ev->ev_lock);
+	if (now - ev->ev_looktime < EMUFS_LOOKUP_TTL) {
+		lock_release(ev->ev_lock);
+		*ret = cached;
+		return 0;
+	}
+	lock_release(ev->ev_lock);
 
-	result = emu_open(ev->ev_emu, ev->ev_handle, pathname, false, false, 0,
-			  &handle, &isdir);
+	result = emufs_hostopen(dir, name, false, false, 0, &handle, &isdir);
 	if (result) {
+		if (result == ENOENT) {
+			vfs_ncache_remove(dir, name);
+		}
+		VOP_DECREF(cached);
 		return result;
 	}
 
+	same = (isdir != 0) == (cached->vn_ops == &emufs_dirops);
+	if (same) {
+		same = emu_getsize(ev->ev_emu, handle, &newsize) == 0 &&
+			emu_getsize(ev->ev_emu, ev->ev_handle, &oldsize) == 0 &&
+			newsize == oldsize;
+	}
+
+	if (same) {
+		emu_close(ev->ev_emu, handle);
+		lock_acquire(ev->ev_lock);
+		ev->ev_looktime = now;
+		lock_release(ev->ev_lock);
+		*ret = cached;
+		return 0;
+	}
+
+	VOP_DECREF(cached);
+
 	result = emufs_loadvnode(ef, handle, isdir, &newguy);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
+		vfs_ncache_remove(dir, name);
+		return result;
+	}
+
+	lock_acquire(newguy->ev_lock);
+	newguy->ev_looktime = now;
+	lock_release(newguy->ev_lock);
+
+	vfs_ncache_enter(dir, name, &newguy->ev_v);
+	*ret = &newguy->ev_v;
+	return 0;
+}
+
+/*
+ * VOP_CREAT
+ *
+ * Always goes to the host, even if the name is cached, so that the
+ * host decides whether an exclusive create fails and a file that was
+ * replaced on the host gets the new handle.
+ */
+static
+int
+emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
+{
+	struct emufs_vnode *newguy;
+	int result;
+
+	result = emufs_openname(dir, name, true, excl, mode, &newguy);
+	if (result) {
+		return result;
+	}
+
+	*ret = &newguy->ev_v;
+	return 0;
+}
+
+/*
+ * VOP_LOOKUP
+ *
+ * Only names that exist are cached; files can appear on the host
+ * behind our back, so a negative entry might be wrong. Cached names
+ * are rechecked with the host once they get old.
+ */
+static
+int
+emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
+{
+	struct emufs_vnode *newguy;
+	struct vnode *cached;
+	int result;
+
+	if (vfs_ncache_lookup(dir, pathname, &cached)) {
+		if (cached != NULL) {
+			return emufs_revalidate(dir, pathname, cached, ret);
+		}
+	}
+
+	result = emufs_openname(dir, pathname, false, false, 0, &newguy);
+	if (result) {
 		return result;
 	}
 
@@ -1085,6 +1677,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_uio_op_notdir, /* getdirentry */
 	emufs_write,
 	emufs_ioctl,
+	emufs_poll,
 	emufs_stat,
 	emufs_file_gettype,
 	emufs_tryseek,
@@ -1120,6 +1713,7 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_getdirentry,
 	emufs_uio_op_isdir,   /* write */
 	emufs_ioctl,
+	emufs_poll,
 	emufs_stat,
 	emufs_dir_gettype,
 	emufs_dir_tryseek,
@@ -1177,17 +1771,31 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+
+	ev->ev_lock = lock_create("emufs-vnode");
+	if (ev->ev_lock == NULL) {
+		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		kfree(ev);
 		return ENOMEM;
 	}
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_sizevalid = false;
+	ev->ev_size = 0;
+	ev->ev_readnext = 0;
+	ev->ev_looktime = 0;
 
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		lock_destroy(ev->ev_lock);
 		kfree(ev);
 		return result;
 	}
@@ -1198,6 +1806,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		VOP_CLEANUP(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		lock_destroy(ev->ev_lock);
 		kfree(ev);
 		return result;
 	}
@@ -1284,6 +1893,7 @@ int
 emufs_addtovfs(struct emu_softc *sc, const char *devname)
 {
 	struct emufs_fs *ef;
+	unsigned i;
 	int result;
 
 	ef = kmalloc(sizeof(struct emufs_fs));
@@ -1305,8 +1915,26 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		return ENOMEM;
 	}
 
+	/* Empty cache; pages get allocated as they're first used */
+	ef->ef_cachelock = lock_create("emufs-cache");
+	if (ef->ef_cachelock == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_pageclock = 0;
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ef->ef_pages[i].ep_vn = NULL;
+		ef->ef_pages[i].ep_offset = 0;
+		ef->ef_pages[i].ep_len = 0;
+		ef->ef_pages[i].ep_stamp = 0;
+		ef->ef_pages[i].ep_data = NULL;
+	}
+
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
+		lock_destroy(ef->ef_cachelock);
+		vnodearray_destroy(ef->ef_vnodes);
 		kfree(ef);
 		return result;
 	}
@@ -1316,6 +1944,8 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 	result = vfs_addfs(devname, &ef->ef_fs);
 	if (result) {
 		VOP_DECREF(&ef->ef_root->ev_v);
+		lock_destroy(ef->ef_cachelock);
+		vnodearray_destroy(ef->ef_vnodes);
 		kfree(ef);
 	}
 	return result;
@@ -1333,6 +1963,7 @@ int
 config_emu(struct emu_softc *sc, int emuno)
 {
 	char name[32];
+	unsigned i;
 
 	sc->e_lock = lock_create("emufs-lock");
 	if (sc->e_lock == NULL) {
@@ -1346,6 +1977,30 @@ config_emu(struct emu_softc *sc, int emuno)
 	}
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
+	sc->e_bouncesem = sem_create("emufs-bounce", EMU_NBOUNCE);
+	if (sc->e_bouncesem == NULL) {
+		sem_destroy(sc->e_sem);
+		lock_destroy(sc->e_lock);
+		sc->e_lock = NULL;
+		return ENOMEM;
+	}
+	spinlock_init(&sc->e_bouncelock);
+	for (i=0; i<EMU_NBOUNCE; i++) {
+		sc->e_bounce[i] = kmalloc(EMU_MAXIO);
+		if (sc->e_bounce[i] == NULL) {
+			while (i > 0) {
+				kfree(sc->e_bounce[--i]);
+			}
+			spinlock_cleanup(&sc->e_bouncelock);
+			sem_destroy(sc->e_bouncesem);
+			sem_destroy(sc->e_sem);
+			lock_destroy(sc->e_lock);
+			sc->e_lock = NULL;
+			return ENOMEM;
+		}
+		sc->e_bounceused[i] = false;
+	}
+
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
 	return emufs_addtovfs(sc, name);
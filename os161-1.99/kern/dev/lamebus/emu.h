@@ -31,8 +31,11 @@
 #define _LAMEBUS_EMU_H_
 
 
+#include <spinlock.h>
+
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
+#define EMU_NBOUNCE     4		/* number of bounce buffers */
 
 /*
  * The per-device data used by the emufs device driver.
@@ -51,6 +54,12 @@ struct emu_softc {
 	struct semaphore *e_sem;
 	void *e_iobuf;
 
+	/* Pool of EMU_MAXIO-sized kernel buffers (see emu_bounce_get) */
+	struct semaphore *e_bouncesem;	/* counts free buffers */
+	struct spinlock e_bouncelock;	/* protects e_bounceused */
+	void *e_bounce[EMU_NBOUNCE];
+	bool e_bounceused[EMU_NBOUNCE];
+
 	/* Written by the interrupt handler */
 	uint32_t e_result;
 };
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -49,8 +50,10 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reading loads the whole bitmap. Writing only writes the sectors
+ * marked in sfs_freemapdirtyblocks (every allocation or free marks
+ * the sector holding its bit), so the cost of a sync depends on how
+ * much allocation happened rather than on the size of the volume.
  *
  * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
  * bits, one bit for each sector on the filesystem. The number of
@@ -63,14 +66,19 @@
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
+ *
+ * Blocks preallocated for files (see sfs_balloc) are marked in the
+ * in-memory freemap so nobody else takes them, but also in sfs_pamap,
+ * and are masked out when writing: on disk they stay free until they
+ * are actually used, so a crash can't leak them.
  */
 
 static
 int
 sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 {
-	uint32_t j, mapsize;
-	char *bitdata;
+	uint32_t j, k, mapsize;
+	char *bitdata, *padata, *buf;
 	int result;
 
 	/* Number of blocks in the bitmap. */
@@ -78,27 +86,52 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 
 	/* Pointer to our bitmap data in memory. */
 	bitdata = bitmap_getdata(sfs->sfs_freemap);
+
+	result = 0;
+	buf = NULL;
+	padata = NULL;
+	if (rw == UIO_WRITE) {
+		buf = kmalloc(SFS_BLOCKSIZE);
+		if (buf == NULL) {
+			return ENOMEM;
+		}
+		padata = bitmap_getdata(sfs->sfs_pamap);
+	}
 	
 	/* For each sector in the bitmap... */
 	for (j=0; j<mapsize; j++) {
 
 		/* Get a pointer to its data */
-		void *ptr = bitdata + j*SFS_BLOCKSIZE;
+		char *ptr = bitdata + j*SFS_BLOCKSIZE;
 
 		/* and read or write it. The bitmap starts at sector 2. */ 
 		if (rw == UIO_READ) {
 			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
 		}
+		else if (bitmap_isset(sfs->sfs_freemapdirtyblocks, j)) {
+			for (k=0; k<SFS_BLOCKSIZE; k++) {
+				buf[k] = ptr[k] & ~padata[j*SFS_BLOCKSIZE + k];
+			}
+			result = sfs_jwblock(sfs, buf, SFS_MAP_LOCATION+j);
+			if (result == 0) {
+				bitmap_unmark(sfs->sfs_freemapdirtyblocks, j);
+			}
+		}
 		else {
-			result = sfs_wblock(sfs, ptr, SFS_MAP_LOCATION+j);
+			/* Unchanged; skip it */
+			result = 0;
 		}
 
 		/* If we failed, stop. */
 		if (result) {
-			return result;
+			break;
 		}
 	}
-	return 0;
+
+	if (buf != NULL) {
+		kfree(buf);
+	}
+	return result;
 }
 
 /*
@@ -111,11 +144,10 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
-	unsigned i, num;
+	struct sfs_vnode *sv, **svs;
+	unsigned i, n;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -148,18 +180,52 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	/*
+	 * Go over the table of loaded vnodes, collecting the ones in
+	 * use and taking a reference to each. Then sync them after
+	 * letting go of sfs_vnlock, since sfs_syncvnode takes sv_lock,
+	 * which comes first. Idle vnodes were synced when they went
+	 * idle and nobody can have changed them since.
+	 *
+	 * The inodes and the freemap all go into the running journal
+	 * transaction, which gets committed at the end, so the whole
+	 * sync is one sequential write.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	svs = NULL;
+	n = 0;
+	if (sfs->sfs_nvnodes > 0) {
+		svs = kmalloc(sfs->sfs_nvnodes * sizeof(*svs));
+		if (svs == NULL) {
+			lock_release(sfs->sfs_vnlock);
+			return ENOMEM;
+		}
+	}
+	for (i=0; i<SFS_VHASH_SIZE; i++) {
+		for (sv = sfs->sfs_vhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			if (!sv->sv_idle) {
+				VOP_INCREF(&sv->sv_v);
+				svs[n++] = sv;
+			}
+		}
 	}
+	lock_release(sfs->sfs_vnlock);
+
+	for (i=0; i<n; i++) {
+		sfs_syncvnode(svs[i]);
+		VOP_DECREF(&svs[i]->sv_v);
+	}
+	if (svs != NULL) {
+		kfree(svs);
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
 
 	/* If the free block map needs to be written, write it. */
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_mapio(sfs, UIO_WRITE);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
@@ -169,14 +235,15 @@ sfs_sync(struct fs *fs)
 	if (sfs->sfs_superdirty) {
 		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
 
-	vfs_biglock_release();
-	return 0;
+	lock_release(sfs->sfs_freemaplock);
+
+	return sfs_jcommit(sfs);
 }
 
 /*
@@ -189,13 +256,27 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_super.sp_volname;
-	vfs_biglock_release();
+	/* The volume name never changes while mounted; no lock needed */
+	return sfs->sfs_super.sp_volname;
+}
 
-	return ret;
+/*
+ * Destroy whichever of the filesystem's locks exist.
+ */
+static
+void
+sfs_destroylocks(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_vnlock != NULL) {
+		lock_destroy(sfs->sfs_vnlock);
+	}
+	if (sfs->sfs_freemaplock != NULL) {
+		lock_destroy(sfs->sfs_freemaplock);
+	}
+	if (sfs->sfs_idlock != NULL) {
+		lock_destroy(sfs->sfs_idlock);
+	}
 }
 
 /*
@@ -208,22 +289,45 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+
+	/* Idle cached vnodes don't count as open; drop them. */
+	result = sfs_vcache_trim(sfs, 0);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
 
-	vfs_biglock_acquire();
-	
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 
+	/*
+	 * Nobody else can get in now: there are no vnodes, and the
+	 * VFS layer won't hand out new ones during unmount.
+	 */
+	lock_release(sfs->sfs_vnlock);
+
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Leave the journal empty, so mounting doesn't need to replay */
+	result = sfs_jcheckpoint(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* Once we start nuking stuff we can't fail. */
-	vnodearray_destroy(sfs->sfs_vnodes);
+	sfs_jdestroy(sfs);
+	bitmap_destroy(sfs->sfs_pamap);
+	bitmap_destroy(sfs->sfs_freemapdirtyblocks);
 	bitmap_destroy(sfs->sfs_freemap);
+	sfs_destroylocks(sfs);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -232,7 +336,6 @@ sfs_unmount(struct fs *fs)
 	kfree(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -255,10 +358,9 @@ int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
+	unsigned i;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -278,34 +380,50 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		return ENXIO;
 	}
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
-	/* Allocate array */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	/* Create the locks */
+	sfs->sfs_vnlock = lock_create("sfs vnodes");
+	sfs->sfs_freemaplock = lock_create("sfs freemap");
+	sfs->sfs_idlock = lock_create("sfs indirect");
+	if (sfs->sfs_vnlock == NULL || sfs->sfs_freemaplock == NULL ||
+	    sfs->sfs_idlock == NULL) {
+		sfs_destroylocks(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
+	/* Set up the (empty) vnode table */
+	for (i=0; i<SFS_VHASH_SIZE; i++) {
+		sfs->sfs_vhash[i] = NULL;
+	}
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_lruhead = sfs->sfs_lrutail = NULL;
+	sfs->sfs_nidle = 0;
+
+	/* Nothing in the indirect block cache yet */
+	for (i=0; i<SFS_IDCACHE_SIZE; i++) {
+		sfs->sfs_idcache[i].ic_block = 0;
+		sfs->sfs_idcache[i].ic_stamp = 0;
+	}
+	sfs->sfs_idclock = 0;
+
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
+	sfs->sfs_journal = NULL;
 
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
-		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_destroylocks(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -316,9 +434,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
-		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_destroylocks(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 	
@@ -330,20 +447,47 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
-	/* Load free space bitmap */
+	/* Set up the journal; this replays it if we crashed */
+	result = sfs_jmount(sfs);
+	if (result) {
+		sfs_destroylocks(sfs);
+		kfree(sfs);
+		return result;
+	}
+
+	/* Load free space bitmap; none of it is dirty yet */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
-		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_jdestroy(sfs);
+		sfs_destroylocks(sfs);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_freemapdirtyblocks = bitmap_create(SFS_FS_BITBLOCKS(sfs));
+	if (sfs->sfs_freemapdirtyblocks == NULL) {
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
+		sfs_destroylocks(sfs);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_pamap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
+	if (sfs->sfs_pamap == NULL) {
+		bitmap_destroy(sfs->sfs_freemapdirtyblocks);
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
+		sfs_destroylocks(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
+		bitmap_destroy(sfs->sfs_pamap);
+		bitmap_destroy(sfs->sfs_freemapdirtyblocks);
 		bitmap_destroy(sfs->sfs_freemap);
-		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_jdestroy(sfs);
+		sfs_destroylocks(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -361,7 +505,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -42,7 +42,11 @@
 // Note: sfs_rblock is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device and sfs_journal (which is NULL
+// until the journal has been set up).
+//
+// sfs_rblock and sfs_wblock know about the metadata
+// journal; sfs_rwblock goes straight to the disk.
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
@@ -50,8 +54,6 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n", 
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -92,6 +94,11 @@ sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block)
 	struct iovec iov;
 	struct uio ku;
 
+	/* The newest copy of a metadata block may be in the journal */
+	if (sfs->sfs_journal != NULL && sfs_jrblock(sfs, data, block)) {
+		return 0;
+	}
+
 	SFSUIO(&iov, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
@@ -101,6 +108,15 @@ sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block)
 {
 	struct iovec iov;
 	struct uio ku;
+	int result;
+
+	/* Make sure replaying the journal won't clobber this write */
+	if (sfs->sfs_journal != NULL) {
+		result = sfs_jrevoke(sfs, block);
+		if (result) {
+			return result;
+		}
+	}
 
 	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
 	return sfs_rwblock(sfs, &ku);
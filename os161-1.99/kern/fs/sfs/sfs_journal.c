@@ -0,0 +1,702 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * SFS metadata journal.
+ *
+ * Metadata writes (inodes, directory blocks, indirect blocks, and the
+ * freemap) come here via sfs_jwblock instead of going to disk. The
+ * block is copied into the running transaction; writing the same
+ * block again before the commit just replaces the copy, so however
+ * many operations touched an inode or directory block, it is written
+ * to the log once. sfs_jcommit sends the whole transaction to the log
+ * with a single sequential write. The blocks stay in memory, and
+ * reads of them are answered from here, until the log gets full or
+ * the volume is unmounted; then they are all written in place and the
+ * log starts over. If we crash in the meantime, the committed
+ * transactions get replayed at the next mount (or by sfsck).
+ *
+ * Everything else (file data, the superblock) is written in place
+ * with sfs_wblock as before. A metadata block can get freed and
+ * then reused for file data, so sfs_wblock calls sfs_jrevoke first:
+ * if the block is still in the journal, a copy that was only in the
+ * running transaction is dropped, and a copy already in the log is
+ * checkpointed right away so replaying the log can't overwrite the
+ * new contents.
+ *
+ * Transactions are a unit of batching, not of atomicity. There is
+ * no way for an operation to reserve room in the running transaction
+ * or to hold off a commit, so one operation's updates can end up
+ * split across two transactions: when the running transaction fills
+ * up (SFS_JMAXTX blocks) in the middle of it, or when another thread
+ * fsyncs. Replay then leaves only the first part applied. Each
+ * metadata block still comes back whole, so the volume is never
+ * garbled, but it can be left inconsistent (for example, a directory
+ * entry naming an inode whose link count never got written), and
+ * that is for sfsck to fix.
+ *
+ * j_lock comes after all the other SFS locks; we never take anything
+ * else while holding it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <sfs.h>
+
+/*
+ * Transfer NBLOCKS blocks between BUF and the disk starting at
+ * BLOCK, with one device request.
+ */
+static
+int
+sfs_jio(struct sfs_fs *sfs, void *buf, uint32_t block, uint32_t nblocks,
+	enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	uio_kinit(&iov, &ku, buf, nblocks * SFS_BLOCKSIZE,
+		  ((off_t)block) * SFS_BLOCKSIZE, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Add the 32-bit words of a block image into SUM.
+ */
+static
+uint32_t
+sfs_jsum(const void *data, uint32_t sum)
+{
+	const uint32_t *words = data;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		sum += words[i];
+	}
+	return sum;
+}
+
+/*
+ * Hash chain for BLOCK.
+ */
+static
+struct sfs_jentry **
+sfs_jchain(struct sfs_journal *j, uint32_t block)
+{
+	return &j->j_hash[block & j->j_hashmask];
+}
+
+/*
+ * Find the table entry for BLOCK, or NULL.
+ */
+static
+struct sfs_jentry *
+sfs_jfind(struct sfs_journal *j, uint32_t block)
+{
+	struct sfs_jentry *je;
+
+	KASSERT(lock_do_i_hold(j->j_lock));
+
+	for (je = *sfs_jchain(j, block); je != NULL; je = je->je_next) {
+		if (je->je_block == block) {
+			return je;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Forget a table entry.
+ */
+static
+void
+sfs_jdrop(struct sfs_journal *j, struct sfs_jentry *je)
+{
+	struct sfs_jentry **jep;
+
+	KASSERT(je->je_block != 0);
+
+	for (jep = sfs_jchain(j, je->je_block); *jep != je;
+	     jep = &(*jep)->je_next) {
+		KASSERT(*jep != NULL);
+	}
+	*jep = je->je_next;
+	je->je_next = j->j_free;
+	j->j_free = je;
+
+	if (je->je_running) {
+		KASSERT(j->j_nrunning > 0);
+		j->j_nrunning--;
+	}
+	kfree(je->je_data);
+	je->je_data = NULL;
+	je->je_block = 0;
+	je->je_running = je->je_logged = false;
+	KASSERT(j->j_nentries > 0);
+	j->j_nentries--;
+}
+
+/*
+ * Write the header, saying the log begins with transaction SEQ.
+ * Uses j_iobuf.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, struct sfs_journal *j, uint32_t seq)
+{
+	struct sfs_jheader *jh = (struct sfs_jheader *)j->j_iobuf;
+
+	bzero(jh, SFS_BLOCKSIZE);
+	jh->jh_magic = SFS_JMAGIC;
+	jh->jh_seq = seq;
+	return sfs_jio(sfs, jh, j->j_start, 1, UIO_WRITE);
+}
+
+static int sfs_jcheckpoint_locked(struct sfs_fs *sfs, struct sfs_journal *j);
+
+/*
+ * Commit the running transaction: descriptor, block images, and
+ * commit record go into the next free part of the log in one write.
+ * If that leaves no room for another full transaction, checkpoint.
+ */
+static
+int
+sfs_jcommit_locked(struct sfs_fs *sfs, struct sfs_journal *j)
+{
+	struct sfs_jdesc *jd;
+	struct sfs_jcommit *jc;
+	struct sfs_jentry *je;
+	uint32_t n, k, sum, i;
+	char *image;
+	int result;
+
+	KASSERT(lock_do_i_hold(j->j_lock));
+
+	n = j->j_nrunning;
+	if (n == 0) {
+		return 0;
+	}
+	KASSERT(n <= SFS_JMAXTX);
+	if (j->j_next + n + 2 > j->j_size) {
+		/*
+		 * Only happens if an earlier checkpoint failed. Write
+		 * everything in place instead.
+		 */
+		return sfs_jcheckpoint_locked(sfs, j);
+	}
+
+	jd = (struct sfs_jdesc *)j->j_iobuf;
+	bzero(jd, SFS_BLOCKSIZE);
+	jd->jd_magic = SFS_JDESC_MAGIC;
+	jd->jd_seq = j->j_seq;
+	jd->jd_nblocks = n;
+
+	sum = 0;
+	k = 0;
+	for (i=0; i<j->j_size; i++) {
+		je = &j->j_entries[i];
+		if (!je->je_running) {
+			continue;
+		}
+		KASSERT(k < n);
+		image = j->j_iobuf + (k+1)*SFS_BLOCKSIZE;
+		memcpy(image, je->je_data, SFS_BLOCKSIZE);
+		sum = sfs_jsum(image, sum);
+		jd->jd_blocks[k++] = je->je_block;
+	}
+	KASSERT(k == n);
+
+	jc = (struct sfs_jcommit *)(j->j_iobuf + (n+1)*SFS_BLOCKSIZE);
+	bzero(jc, SFS_BLOCKSIZE);
+	jc->jc_magic = SFS_JCOMMIT_MAGIC;
+	jc->jc_seq = j->j_seq;
+	jc->jc_nblocks = n;
+	jc->jc_sum = sum;
+
+	result = sfs_jio(sfs, j->j_iobuf, j->j_start + j->j_next, n + 2,
+			 UIO_WRITE);
+	if (result) {
+		/* Leave it all running; we'll try again next time */
+		return result;
+	}
+
+	for (i=0; i<j->j_size; i++) {
+		je = &j->j_entries[i];
+		if (je->je_running) {
+			je->je_running = false;
+			je->je_logged = true;
+		}
+	}
+	j->j_nrunning = 0;
+	j->j_next += n + 2;
+	j->j_seq++;
+
+	if (j->j_next + SFS_JMAXTX + 2 > j->j_size) {
+		return sfs_jcheckpoint_locked(sfs, j);
+	}
+	return 0;
+}
+
+/*
+ * Checkpoint: commit whatever is running, write every block in the
+ * table to its real location (in ascending block order, to keep the
+ * disk head moving one way), and then empty the log by rewriting the
+ * header. If we crash partway, replay just does the writes again.
+ * (If the running transaction doesn't fit in the log, which can only
+ * happen after an I/O error, it is written in place with the rest.)
+ */
+static
+int
+sfs_jcheckpoint_locked(struct sfs_fs *sfs, struct sfs_journal *j)
+{
+	struct sfs_jentry *je, *low;
+	uint32_t last;
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(j->j_lock));
+
+	if (j->j_nrunning > 0 &&
+	    j->j_next + j->j_nrunning + 2 <= j->j_size) {
+		result = sfs_jcommit_locked(sfs, j);
+		if (result) {
+			return result;
+		}
+	}
+	if (j->j_nentries == 0 && j->j_next == 1) {
+		/* Nothing to do */
+		return 0;
+	}
+
+	last = 0;
+	while (1) {
+		low = NULL;
+		for (i=0; i<j->j_size; i++) {
+			je = &j->j_entries[i];
+			if (je->je_block > last &&
+			    (low == NULL || je->je_block < low->je_block)) {
+				low = je;
+			}
+		}
+		if (low == NULL) {
+			break;
+		}
+		result = sfs_jio(sfs, low->je_data, low->je_block, 1,
+				 UIO_WRITE);
+		if (result) {
+			return result;
+		}
+		last = low->je_block;
+	}
+
+	result = sfs_jwriteheader(sfs, j, j->j_seq);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<j->j_size; i++) {
+		if (j->j_entries[i].je_block != 0) {
+			sfs_jdrop(j, &j->j_entries[i]);
+		}
+	}
+	KASSERT(j->j_nentries == 0);
+	j->j_next = 1;
+	return 0;
+}
+
+/*
+ * Write metadata block BLOCK into the running transaction. If there
+ * is no journal, just write it.
+ */
+int
+sfs_jwblock(struct sfs_fs *sfs, void *data, uint32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry *je, **chain;
+	int result;
+
+	if (j == NULL) {
+		return sfs_wblock(sfs, data, block);
+	}
+
+	KASSERT(block != 0);
+
+	lock_acquire(j->j_lock);
+
+	je = sfs_jfind(j, block);
+	if ((je == NULL || !je->je_running) && j->j_nrunning == SFS_JMAXTX) {
+		/* Transaction is full; commit it and start another */
+		result = sfs_jcommit_locked(sfs, j);
+		if (result) {
+			lock_release(j->j_lock);
+			return result;
+		}
+		/* it may have been checkpointed away */
+		je = sfs_jfind(j, block);
+	}
+
+	if (je == NULL && j->j_nentries >= j->j_size) {
+		/*
+		 * Only after a checkpoint failed: the log got full
+		 * and we couldn't empty it. Try again; if it fails
+		 * again, so does this write.
+		 */
+		result = sfs_jcheckpoint_locked(sfs, j);
+		if (result) {
+			lock_release(j->j_lock);
+			return result;
+		}
+	}
+
+	if (je == NULL) {
+		/* Each block in the log is in the table, so there's room */
+		KASSERT(j->j_nentries < j->j_size);
+		je = j->j_free;
+		KASSERT(je != NULL);
+		je->je_data = kmalloc(SFS_BLOCKSIZE);
+		if (je->je_data == NULL) {
+			lock_release(j->j_lock);
+			return ENOMEM;
+		}
+		j->j_free = je->je_next;
+		chain = sfs_jchain(j, block);
+		je->je_next = *chain;
+		*chain = je;
+		je->je_block = block;
+		je->je_running = je->je_logged = false;
+		j->j_nentries++;
+	}
+
+	memcpy(je->je_data, data, SFS_BLOCKSIZE);
+	if (!je->je_running) {
+		je->je_running = true;
+		j->j_nrunning++;
+	}
+
+	lock_release(j->j_lock);
+	return 0;
+}
+
+/*
+ * If BLOCK is in the journal, copy its contents to DATA and return
+ * true. Otherwise the copy on disk is current; return false.
+ */
+bool
+sfs_jrblock(struct sfs_fs *sfs, void *data, uint32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry *je;
+
+	KASSERT(j != NULL);
+
+	lock_acquire(j->j_lock);
+	je = sfs_jfind(j, block);
+	if (je != NULL) {
+		memcpy(data, je->je_data, SFS_BLOCKSIZE);
+	}
+	lock_release(j->j_lock);
+
+	return je != NULL;
+}
+
+/*
+ * BLOCK is about to be written in place; get it out of the journal.
+ */
+int
+sfs_jrevoke(struct sfs_fs *sfs, uint32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry *je;
+	int result = 0;
+
+	KASSERT(j != NULL);
+
+	lock_acquire(j->j_lock);
+	je = sfs_jfind(j, block);
+	if (je != NULL && je->je_logged) {
+		result = sfs_jcheckpoint_locked(sfs, j);
+	}
+	else if (je != NULL) {
+		sfs_jdrop(j, je);
+	}
+	lock_release(j->j_lock);
+
+	return result;
+}
+
+/*
+ * Commit the running transaction.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	lock_acquire(j->j_lock);
+	result = sfs_jcommit_locked(sfs, j);
+	lock_release(j->j_lock);
+
+	return result;
+}
+
+/*
+ * Commit the running transaction and checkpoint the log.
+ */
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	lock_acquire(j->j_lock);
+	result = sfs_jcheckpoint_locked(sfs, j);
+	lock_release(j->j_lock);
+
+	return result;
+}
+
+/*
+ * Replay the log: apply each complete transaction, in order, until we
+ * hit one that isn't, then empty the log. The images are read into
+ * j_iobuf with one request per transaction.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs, struct sfs_journal *j)
+{
+	struct sfs_jheader *jh;
+	struct sfs_jdesc *jd;
+	struct sfs_jcommit *jc;
+	uint32_t seq, off, n, sum, i, block;
+	char *images;
+	unsigned ntx;
+	int result;
+
+	jh = (struct sfs_jheader *)j->j_iobuf;
+	result = sfs_jio(sfs, jh, j->j_start, 1, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (jh->jh_magic != SFS_JMAGIC) {
+		kprintf("sfs: %s: bad journal header; run sfsck\n",
+			sfs->sfs_super.sp_volname);
+		return EINVAL;
+	}
+	seq = jh->jh_seq;
+
+	/* descriptor in the first block, images after, commit last */
+	jd = (struct sfs_jdesc *)j->j_iobuf;
+	images = j->j_iobuf + SFS_BLOCKSIZE;
+
+	ntx = 0;
+	for (off = 1; off + 2 <= j->j_size; off += n + 2) {
+		result = sfs_jio(sfs, jd, j->j_start + off, 1, UIO_READ);
+		if (result) {
+			return result;
+		}
+		n = jd->jd_nblocks;
+		if (jd->jd_magic != SFS_JDESC_MAGIC || jd->jd_seq != seq ||
+		    n == 0 || n > SFS_JMAXTX || off + n + 2 > j->j_size) {
+			break;
+		}
+
+		result = sfs_jio(sfs, images, j->j_start + off + 1, n + 1,
+				 UIO_READ);
+		if (result) {
+			return result;
+		}
+		jc = (struct sfs_jcommit *)(images + n*SFS_BLOCKSIZE);
+		sum = 0;
+		for (i=0; i<n; i++) {
+			sum = sfs_jsum(images + i*SFS_BLOCKSIZE, sum);
+		}
+		if (jc->jc_magic != SFS_JCOMMIT_MAGIC || jc->jc_seq != seq ||
+		    jc->jc_nblocks != n || jc->jc_sum != sum) {
+			/* Never finished committing; ignore it */
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			block = jd->jd_blocks[i];
+			if (block == SFS_SB_LOCATION ||
+			    block >= sfs->sfs_super.sp_nblocks ||
+			    (block >= j->j_start &&
+			     block < j->j_start + j->j_size)) {
+				kprintf("sfs: %s: journal transaction %u "
+					"has bad block %u; run sfsck\n",
+					sfs->sfs_super.sp_volname, seq, block);
+				return EINVAL;
+			}
+		}
+		for (i=0; i<n; i++) {
+			result = sfs_jio(sfs, images + i*SFS_BLOCKSIZE,
+					 jd->jd_blocks[i], 1, UIO_WRITE);
+			if (result) {
+				return result;
+			}
+		}
+		seq++;
+		ntx++;
+	}
+
+	if (ntx > 0) {
+		kprintf("sfs: %s: replayed %u journal transaction%s\n",
+			sfs->sfs_super.sp_volname, ntx, ntx == 1 ? "" : "s");
+		result = sfs_jwriteheader(sfs, j, seq);
+		if (result) {
+			return result;
+		}
+	}
+
+	j->j_seq = seq;
+	j->j_next = 1;
+	return 0;
+}
+
+/*
+ * Set up the journal at mount time, replaying anything left in it.
+ * The superblock must already be loaded.
+ */
+int
+sfs_jmount(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j;
+	uint32_t start, size, nchains, i;
+	int result;
+
+	sfs->sfs_journal = NULL;
+
+	start = sfs->sfs_super.sp_journalstart;
+	size = sfs->sfs_super.sp_journalblocks;
+	if (size == 0) {
+		/* No journal on this volume */
+		return 0;
+	}
+	if (start <= SFS_MAP_LOCATION || size < SFS_JMINSIZE ||
+	    start + size > sfs->sfs_super.sp_nblocks ||
+	    start + size < start) {
+		kprintf("sfs: %s: bad journal location %u size %u\n",
+			sfs->sfs_super.sp_volname, start, size);
+		return EINVAL;
+	}
+
+	j = kmalloc(sizeof(*j));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_start = start;
+	j->j_size = size;
+	j->j_nrunning = 0;
+	j->j_nentries = 0;
+
+	/* a power of two, about one chain for every two entries */
+	for (nchains = 1; nchains * 2 < size; nchains *= 2) {
+		/* nothing */
+	}
+	j->j_hashmask = nchains - 1;
+
+	j->j_lock = lock_create("sfs journal");
+	j->j_entries = kmalloc(size * sizeof(struct sfs_jentry));
+	j->j_hash = kmalloc(nchains * sizeof(struct sfs_jentry *));
+	j->j_iobuf = kmalloc((SFS_JMAXTX + 2) * SFS_BLOCKSIZE);
+	if (j->j_lock == NULL || j->j_entries == NULL || j->j_hash == NULL ||
+	    j->j_iobuf == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	for (i=0; i<nchains; i++) {
+		j->j_hash[i] = NULL;
+	}
+	j->j_free = NULL;
+	for (i=size; i-- > 0; ) {
+		j->j_entries[i].je_block = 0;
+		j->j_entries[i].je_running = false;
+		j->j_entries[i].je_logged = false;
+		j->j_entries[i].je_data = NULL;
+		j->j_entries[i].je_next = j->j_free;
+		j->j_free = &j->j_entries[i];
+	}
+
+	result = sfs_jreplay(sfs, j);
+	if (result) {
+		goto fail;
+	}
+
+	sfs->sfs_journal = j;
+	return 0;
+
+ fail:
+	if (j->j_iobuf != NULL) {
+		kfree(j->j_iobuf);
+	}
+	if (j->j_hash != NULL) {
+		kfree(j->j_hash);
+	}
+	if (j->j_entries != NULL) {
+		kfree(j->j_entries);
+	}
+	if (j->j_lock != NULL) {
+		lock_destroy(j->j_lock);
+	}
+	kfree(j);
+	return result;
+}
+
+/*
+ * Tear down the journal. It must have been checkpointed.
+ */
+void
+sfs_jdestroy(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+	KASSERT(j->j_nentries == 0);
+
+	kfree(j->j_iobuf);
+	kfree(j->j_hash);
+	kfree(j->j_entries);
+	lock_destroy(j->j_lock);
+	kfree(j);
+	sfs->sfs_journal = NULL;
+}
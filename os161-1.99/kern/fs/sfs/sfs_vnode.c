@@ -43,12 +43,17 @@
 #include <synch.h>
 #include <vfs.h>
 #include <device.h>
+#include <poll.h>
 #include <sfs.h>
 
 /* At bottom of file */
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/* Further down */
+static int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+static void sfs_ovindex_destroy(struct sfs_vnode *sv);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -58,19 +63,22 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 {
-	/* static -> automatically initialized to zero */
+	/* static -> automatically initialized to zero; never written */
 	static char zeros[SFS_BLOCKSIZE];
 	return sfs_wblock(sfs, zeros, block);
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/*
+ * Write an on-disk inode structure back out to disk (by way of the
+ * journal). The caller must hold sv_lock (or be sfs_reclaim).
+ */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		int result = sfs_jwblock(sfs, &sv->sv_i, sv->sv_ino);
 		if (result) {
 			return result;
 		}
@@ -79,33 +87,205 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Indirect block cache
+
+/*
+ * Get the contents of indirect block BLOCK, from the cache if
+ * possible. If FRESH is set, the block was just allocated (and thus
+ * zeroed on disk) so there is no need to read it. The pointer handed
+ * back is only good while sfs_idlock stays held. Callers that change
+ * the contents must write the block back with sfs_jwblock themselves.
+ */
+static
+int
+sfs_idget(struct sfs_fs *sfs, uint32_t block, bool fresh, uint32_t **ret)
+{
+	struct sfs_idcache *ic, *victim;
+	unsigned i;
+	int result;
+
+	KASSERT(block != 0);
+	KASSERT(lock_do_i_hold(sfs->sfs_idlock));
+
+	sfs->sfs_idclock++;
+
+	victim = &sfs->sfs_idcache[0];
+	for (i=0; i<SFS_IDCACHE_SIZE; i++) {
+		ic = &sfs->sfs_idcache[i];
+		if (ic->ic_block == block) {
+			ic->ic_stamp = sfs->sfs_idclock;
+			*ret = ic->ic_data;
+			return 0;
+		}
+		/* Unused entries have stamp 0, so get picked first */
+		if (ic->ic_stamp < victim->ic_stamp) {
+			victim = ic;
+		}
+	}
+
+	victim->ic_block = 0;
+	victim->ic_stamp = 0;
+	if (fresh) {
+		bzero(victim->ic_data, sizeof(victim->ic_data));
+	}
+	else {
+		result = sfs_rblock(sfs, victim->ic_data, block);
+		if (result) {
+			return result;
+		}
+	}
+	victim->ic_block = block;
+	victim->ic_stamp = sfs->sfs_idclock;
+	*ret = victim->ic_data;
+	return 0;
+}
+
+/*
+ * Drop BLOCK from the indirect block cache, if it's there. The caller
+ * must hold sfs_idlock.
+ */
+static
+void
+sfs_idforget(struct sfs_fs *sfs, uint32_t block)
+{
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_idlock));
+
+	for (i=0; i<SFS_IDCACHE_SIZE; i++) {
+		if (sfs->sfs_idcache[i].ic_block == block) {
+			sfs->sfs_idcache[i].ic_block = 0;
+			sfs->sfs_idcache[i].ic_stamp = 0;
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Space allocation
 
+/*
+ * Note that the freemap bit for BLOCK has changed, so the freemap
+ * block holding it needs to be written back. The caller must hold
+ * sfs_freemaplock.
+ */
+static
+void
+sfs_freemap_touch(struct sfs_fs *sfs, uint32_t block)
+{
+	uint32_t mapblock = block / SFS_BLOCKBITS;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (!bitmap_isset(sfs->sfs_freemapdirtyblocks, mapblock)) {
+		bitmap_mark(sfs->sfs_freemapdirtyblocks, mapblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
 /*
  * Allocate a block.
+ *
+ * If SV is not NULL, the block is for that file: use one of its
+ * preallocated blocks if it has any, otherwise take the first free
+ * block at or after its goal block. If PREALLOC is also set (the
+ * file is being extended) reserve up to SFS_PREALLOC free blocks
+ * directly following the new one for later use. The caller must hold
+ * SV's sv_lock.
+ *
+ * Preallocated blocks are only reserved in memory (see sfs_mapio);
+ * they reach the on-disk freemap when they are handed out here.
+ *
+ * The block is zeroed on disk unless NOCLEAR is set, in which case
+ * the caller must write all of it.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, struct sfs_vnode *sv, bool prealloc,
+	   bool noclear, uint32_t *diskblock)
 {
+	uint32_t block;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
-	if (result) {
-		return result;
+	lock_acquire(sfs->sfs_freemaplock);
+
+	if (sv != NULL && sv->sv_palen > 0) {
+		/* Already marked in the freemap; now really in use */
+		*diskblock = sv->sv_pastart++;
+		sv->sv_palen--;
+		bitmap_unmark(sfs->sfs_pamap, *diskblock);
+		sfs_freemap_touch(sfs, *diskblock);
+	}
+	else {
+		if (sv != NULL) {
+			result = bitmap_alloc_near(sfs->sfs_freemap,
+						   sv->sv_goal, diskblock);
+		}
+		else {
+			result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+		}
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+		sfs_freemap_touch(sfs, *diskblock);
+
+		if (sv != NULL && prealloc) {
+			sv->sv_pastart = *diskblock + 1;
+			for (block = sv->sv_pastart;
+			     block < sfs->sfs_super.sp_nblocks &&
+				     sv->sv_palen < SFS_PREALLOC &&
+				     !bitmap_isset(sfs->sfs_freemap, block);
+			     block++) {
+				bitmap_mark(sfs->sfs_freemap, block);
+				bitmap_mark(sfs->sfs_pamap, block);
+				sv->sv_palen++;
+			}
+		}
 	}
-	sfs->sfs_freemapdirty = true;
 
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
 
+	lock_release(sfs->sfs_freemaplock);
+
+	if (sv != NULL) {
+		sv->sv_goal = *diskblock + 1;
+	}
+
+	if (noclear) {
+		return 0;
+	}
+
 	/* Clear block before returning it */
 	return sfs_clearblock(sfs, *diskblock);
 }
 
+/*
+ * Give back any blocks preallocated for SV that it didn't use. They
+ * were never marked on disk, so the freemap isn't dirtied.
+ */
+static
+void
+sfs_prealloc_release(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	if (sv->sv_palen == 0) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	while (sv->sv_palen > 0) {
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_pastart);
+		bitmap_unmark(sfs->sfs_pamap, sv->sv_pastart);
+		sv->sv_pastart++;
+		sv->sv_palen--;
+	}
+	lock_release(sfs->sfs_freemaplock);
+}
+
 /*
  * Free a block.
  */
@@ -113,8 +293,15 @@ static
 void
 sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	/* If it was an indirect block, it isn't any more */
+	lock_acquire(sfs->sfs_idlock);
+	sfs_idforget(sfs, diskblock);
+	lock_release(sfs->sfs_idlock);
+
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_touch(sfs, diskblock);
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -124,11 +311,171 @@ static
 int
 sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: sfs_bused called on out of range block %u\n", 
 		      diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Table of loaded vnodes
+//
+// Everything in this section requires sfs_vnlock.
+
+/*
+ * Find a loaded vnode by inode number. Returns NULL if it isn't in
+ * memory. Does not touch the reference count.
+ */
+static
+struct sfs_vnode *
+sfs_vhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	for (sv = sfs->sfs_vhash[SFS_VHASH(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Add a vnode to the hash table.
+ */
+static
+void
+sfs_vhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned bucket = SFS_VHASH(sv->sv_ino);
+
+	sv->sv_hashnext = sfs->sfs_vhash[bucket];
+	sfs->sfs_vhash[bucket] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+/*
+ * Remove a vnode from the hash table.
+ */
+static
+void
+sfs_vhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+
+	for (pp = &sfs->sfs_vhash[SFS_VHASH(sv->sv_ino)]; *pp != NULL;
+	     pp = &(*pp)->sv_hashnext) {
+		if (*pp == sv) {
+			*pp = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			KASSERT(sfs->sfs_nvnodes > 0);
+			sfs->sfs_nvnodes--;
+			return;
+		}
+	}
+	panic("sfs: vnode %u not in vnode table\n", sv->sv_ino);
+}
+
+/*
+ * Put an unreferenced vnode at the most-recently-used end of the
+ * idle list.
+ */
+static
+void
+sfs_lru_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(!sv->sv_idle);
+
+	sv->sv_idle = true;
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = sfs->sfs_lrutail;
+	if (sfs->sfs_lrutail != NULL) {
+		sfs->sfs_lrutail->sv_lrunext = sv;
+	}
+	else {
+		sfs->sfs_lruhead = sv;
+	}
+	sfs->sfs_lrutail = sv;
+	sfs->sfs_nidle++;
+}
+
+/*
+ * Take a vnode off the idle list.
+ */
+static
+void
+sfs_lru_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_idle);
+
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs->sfs_lruhead = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs->sfs_lrutail = sv->sv_lruprev;
+	}
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
+	sv->sv_idle = false;
+	KASSERT(sfs->sfs_nidle > 0);
+	sfs->sfs_nidle--;
+}
+
+/*
+ * Remove a vnode from the table and release its memory. The vnode
+ * must hold exactly the one reference it was created with.
+ */
+static
+void
+sfs_destroyvnode(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(!sv->sv_idle);
+	sfs_vhash_remove(sfs, sv);
+	VOP_CLEANUP(&sv->sv_v);
+	sfs_ovindex_destroy(sv);
+	lock_destroy(sv->sv_lock);
+	kfree(sv);
+}
+
+/*
+ * Throw away idle vnodes, oldest first, until at most MAX remain.
+ * Idle vnodes were synced when they went idle, but sync again in
+ * case; if that fails, leave the vnode cached and report the error.
+ */
+int
+sfs_vcache_trim(struct sfs_fs *sfs, unsigned max)
+{
+	struct sfs_vnode *sv;
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	while (sfs->sfs_nidle > max) {
+		sv = sfs->sfs_lruhead;
+		result = sfs_sync_inode(sv);
+		if (result) {
+			return result;
+		}
+		sfs_lru_remove(sfs, sv);
+		sfs_destroyvnode(sfs, sv);
+	}
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -139,29 +486,34 @@ sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated. The caller must hold sv_lock.
+ *
+ * A newly allocated data block is zeroed, unless NEWBLOCK is not
+ * NULL: then *NEWBLOCK says whether the block is new, and if it is
+ * the caller must write all of it (or zero it).
  */
 static
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
-	 uint32_t *diskblock)
+	 bool *newblock, uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	uint32_t block;
-	uint32_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t *idbuf;
+	uint32_t *toplevel;
+	uint32_t block, next, idoff;
+	uint32_t span, treeblock;
+	unsigned levels, i;
+	bool fresh, extending;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (newblock != NULL) {
+		*newblock = false;
+	}
+
+	/* Allocating past EOF? If so, preallocate ahead. */
+	extending = fileblock >= DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -176,10 +528,14 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc(sfs, sv, extending,
+					    newblock != NULL, &block);
 			if (result) {
 				return result;
 			}
+			if (newblock != NULL) {
+				*newblock = true;
+			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
@@ -198,29 +554,35 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * It's not a direct block; it must be under the single, double,
+	 * or triple indirect block. Work out which, and subtract off the
+	 * blocks mapped before it, so TREEBLOCK is the offset within
+	 * that tree.
 	 */
-	if (idnum > 0) {
+	treeblock = fileblock - SFS_NDIRECT;
+	if (treeblock < SFS_DBPERIDB) {
+		toplevel = &sv->sv_i.sfi_indirect;
+		levels = 1;
+	}
+	else if ((treeblock -= SFS_DBPERIDB) < SFS_DBPERIDB*SFS_DBPERIDB) {
+		toplevel = &sv->sv_i.sfi_dindirect;
+		levels = 2;
+	}
+	else if ((treeblock -= SFS_DBPERIDB*SFS_DBPERIDB)
+		 < SFS_DBPERIDB*SFS_DBPERIDB*SFS_DBPERIDB) {
+		toplevel = &sv->sv_i.sfi_tindirect;
+		levels = 3;
+	}
+	else {
+		/* Past the end of the triple indirect block; too big. */
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	block = *toplevel;
+	fresh = false;
 
-	if (idblock==0 && !doalloc) {
+	if (block==0 && !doalloc) {
 		/*
 		 * There's no indirect block allocated. We weren't
 		 * asked to allocate anything, so pretend the indirect
@@ -229,59 +591,107 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		*diskblock = 0;
 		return 0;
 	}
-	else if (idblock==0) {
+	else if (block==0) {
 		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * We need to allocate a block whose number needs to be
+		 * stored in an indirect block that doesn't exist yet,
+		 * so allocate the indirect block first.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc(sfs, sv, extending, false, &block);
 		if (result) {
 			return result;
 		}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
+		/* Remember the block we just allocated; mark inode dirty */
+		*toplevel = block;
 		sv->sv_dirty = true;
+		fresh = true;
+	}
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	/* Number of file blocks mapped by each entry at the top level */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
+
+	/*
+	 * Walk down the tree, one level of indirection at a time,
+	 * allocating missing indirect blocks (and the data block at
+	 * the bottom) if asked to. Hold sfs_idlock while using IDBUF,
+	 * as it points into the shared cache.
+	 */
+	lock_acquire(sfs->sfs_idlock);
+	for (; levels > 0; levels--) {
+		result = sfs_idget(sfs, block, fresh, &idbuf);
 		if (result) {
+			lock_release(sfs->sfs_idlock);
 			return result;
 		}
-	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+		idoff = treeblock / span;
+		treeblock %= span;
+		span /= SFS_DBPERIDB;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
+		next = idbuf[idoff];
+
+		if (next==0 && !doalloc) {
+			/* Hole; reads as zeros */
+			lock_release(sfs->sfs_idlock);
+			*diskblock = 0;
+			return 0;
 		}
+		else if (next==0) {
+			/*
+			 * Allocate (and zero) the new block without
+			 * sfs_idlock, so other files' block lookups
+			 * don't wait behind the disk write. We hold
+			 * sv_lock, so nobody else can fill in this
+			 * entry meanwhile; but the cache slot may have
+			 * been reused, so get IDBUF again. (At the
+			 * bottom level it's the data block, which the
+			 * caller may be about to fill in itself.)
+			 */
+			lock_release(sfs->sfs_idlock);
+			result = sfs_balloc(sfs, sv, extending,
+					    levels == 1 && newblock != NULL,
+					    &next);
+			if (result) {
+				return result;
+			}
+			lock_acquire(sfs->sfs_idlock);
+			result = sfs_idget(sfs, block, fresh, &idbuf);
+			if (result) {
+				lock_release(sfs->sfs_idlock);
+				sfs_bfree(sfs, next);
+				return result;
+			}
+			KASSERT(idbuf[idoff] == 0);
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+			/* Remember the block we allocated */
+			idbuf[idoff] = next;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+			/* The indirect block is now dirty; write it back */
+			result = sfs_jwblock(sfs, idbuf, block);
+			if (result) {
+				sfs_idforget(sfs, block);
+				lock_release(sfs->sfs_idlock);
+				return result;
+			}
+			fresh = true;
+			if (levels == 1 && newblock != NULL) {
+				*newblock = true;
+			}
+		}
+		else {
+			fresh = false;
 		}
+
+		block = next;
 	}
+	lock_release(sfs->sfs_idlock);
 
 	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
+	if (!sfs_bused(sfs, block)) {
 		panic("sfs: Data block %u (block %u of file %u) marked free\n",
 		      block, fileblock, sv->sv_ino);
 	}
@@ -308,16 +718,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	char *iobuf;
 	uint32_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -331,18 +733,28 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
 	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, doalloc, NULL, &diskblock);
 	if (result) {
 		return result;
 	}
 
+	/*
+	 * I/O buffer for handling partial sectors. (Not on the stack,
+	 * which is too small, and not static, since several files may
+	 * be doing I/O at once.)
+	 */
+	iobuf = kmalloc(SFS_BLOCKSIZE);
+	if (iobuf == NULL) {
+		return ENOMEM;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
@@ -350,7 +762,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		 */
 		result = sfs_rblock(sfs, iobuf, diskblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -359,32 +771,67 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, write back the modified block. Directory
+	 * blocks are metadata and go through the journal. (sfs_io
+	 * sends all directory I/O here, whole blocks included.)
 	 */
-	if (uio->uio_rw == UIO_WRITE) {
+	if (uio->uio_rw == UIO_WRITE && sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+		result = sfs_jwblock(sfs, iobuf, diskblock);
+	}
+	else if (uio->uio_rw == UIO_WRITE) {
 		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
 	}
 
-	return 0;
+ out:
+	kfree(iobuf);
+	return result;
+}
+
+/*
+ * Zero the blocks of a run starting at DISKBLOCK that were newly
+ * allocated (NEWBLOCKS[i] set) but didn't get written, so the file
+ * can't show whatever they held before. Errors are ignored; we're
+ * already failing.
+ */
+static
+void
+sfs_runclear(struct sfs_fs *sfs, uint32_t diskblock, const bool *newblocks,
+	     uint32_t nblocks)
+{
+	uint32_t i;
+
+	for (i=0; i<nblocks; i++) {
+		if (newblocks[i]) {
+			(void)sfs_clearblock(sfs, diskblock + i);
+		}
+	}
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of up to NBLOCKS whole blocks. The
+ * blocks are mapped one at a time for as long as they're contiguous
+ * on disk (up to SFS_MAXRUN of them), and then the whole run is
+ * transferred to or from the uio region with one device request.
+ * Sets *DONE to the number of blocks handled.
+ *
+ * Blocks allocated for a write aren't zeroed first, since the run
+ * write covers them completely. If the write doesn't happen, they
+ * are zeroed then instead.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_runio(struct sfs_vnode *sv, struct uio *uio, uint32_t nblocks,
+	  uint32_t *done)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	uint32_t diskblock;
+	uint32_t diskblock, nextblock;
 	uint32_t fileblock;
+	uint32_t run;
+	bool newblocks[SFS_MAXRUN];
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
 	off_t saveoff;
@@ -392,11 +839,14 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	off_t saveres;
 	off_t diskres;
 
+	KASSERT(nblocks > 0);
+	*done = 0;
+
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
 	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, doalloc, &newblocks[0], &diskblock);
 	if (result) {
 		return result;
 	}
@@ -409,26 +859,59 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
+		*done = 1;
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * See how many of the following blocks come right after it on
+	 * disk. When writing, this allocates them; if one turns out
+	 * not to be contiguous it will be used by the next run.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
+	if (nblocks > SFS_MAXRUN) {
+		nblocks = SFS_MAXRUN;
+	}
+	for (run = 1; run < nblocks; run++) {
+		result = sfs_bmap(sv, fileblock + run, doalloc,
+				  &newblocks[run], &nextblock);
+		if (result) {
+			sfs_runclear(sfs, diskblock, newblocks, run);
+			return result;
+		}
+		if (nextblock != diskblock + run) {
+			/* Not in this run, so nothing is covering it */
+			if (newblocks[run]) {
+				result = sfs_clearblock(sfs, nextblock);
+				if (result) {
+					sfs_runclear(sfs, diskblock,
+						     newblocks, run);
+					return result;
+				}
+			}
+			break;
+		}
+	}
+
+	/*
+	 * Do the I/O directly to the uio region. Save the uio_offset,
+	 * and substitute one that makes sense to the device.
+	 */
+	saveoff = uio->uio_offset;
+	diskoff = (off_t)diskblock * SFS_BLOCKSIZE;
+	uio->uio_offset = diskoff;
+
+	/*
+	 * Temporarily set the residue to be the length of the run.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+	diskres = (off_t)run * SFS_BLOCKSIZE;
+	KASSERT(uio->uio_resid >= diskres);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
 	uio->uio_resid = diskres;
 	
 	result = sfs_rwblock(sfs, uio);
+	if (result) {
+		sfs_runclear(sfs, diskblock, newblocks, run);
+	}
 
 	/*
 	 * Now, restore the original uio_offset and uio_resid and update 
@@ -437,6 +920,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
 	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
 
+	*done = run;
 	return result;
 }
 
@@ -448,7 +932,7 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, done;
 	int result = 0;
 	uint32_t extraresid = 0;
 
@@ -502,15 +986,29 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Now we should be block-aligned. Do the remaining whole blocks.
+	 * Now we should be block-aligned. Do the remaining whole blocks,
+	 * a contiguous run at a time.
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (nblocks > 0) {
+		if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+			/*
+			 * The newest copy of a directory block may be
+			 * in the journal, which sfs_runio would go
+			 * around; do them one at a time instead.
+			 */
+			result = sfs_partialio(sv, uio, 0, SFS_BLOCKSIZE);
+			done = 1;
+		}
+		else {
+			result = sfs_runio(sv, uio, nblocks, &done);
+		}
 		if (result) {
 			goto out;
 		}
+		KASSERT(done > 0 && done <= nblocks);
+		nblocks -= done;
 	}
 
 	/*
@@ -567,73 +1065,724 @@ sfs_readdir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
 	/* do it */
 	result = sfs_io(sv, &ku);
 	if (result) {
-		return result;
+		return result;
+	}
+
+	/* We should not hit EOF in the middle of a directory entry */
+	if (ku.uio_resid > 0) {
+		panic("sfs: readdir: Short entry (inode %u)\n", sv->sv_ino);
+	}
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Write (overwrite) the directory entry in slot SLOT of a directory
+ * vnode.
+ */
+static
+int
+sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t actualpos;
+	int result;
+
+	/* Compute the actual position in the directory. */
+	KASSERT(slot>=0);
+	actualpos = slot * sizeof(struct sfs_dir);
+
+	/* Set up a uio to do the write */ 
+	uio_kinit(&iov, &ku, sd, sizeof(struct sfs_dir), actualpos, UIO_WRITE);
+
+	/* do it */
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+
+	/* Should not end up with a partial entry! */
+	if (ku.uio_resid > 0) {
+		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	}
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Compute the number of entries in a directory.
+ * This actually computes the number of existing slots, and does not
+ * account for empty slots.
+ */
+static
+int
+sfs_dir_nentries(struct sfs_vnode *sv)
+{
+	off_t size;
+
+	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
+
+	size = sv->sv_i.sfi_size;
+	if (size % sizeof(struct sfs_dir) != 0) {
+		panic("sfs: directory %u: Invalid size %llu\n",
+		      sv->sv_ino, size);
+	}
+
+	return size / sizeof(struct sfs_dir);
+}
+
+/*
+ * Hash function for hashed directories; see kern/sfs.h.
+ */
+static
+uint32_t
+sfs_dirhash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+
+	while (*name) {
+		h = SFS_DIRHASH_STEP(h, *name);
+		name++;
+	}
+	return h;
+}
+
+/*
+ * Bucket of a name with hash H in a hashed directory with NBUCKETS
+ * buckets, by linear hashing; see kern/sfs.h.
+ */
+static
+uint32_t
+sfs_dirbucket(uint32_t h, uint32_t nbuckets)
+{
+	uint32_t m, b;
+
+	KASSERT(nbuckets > 0);
+
+	/* largest power of two not greater than nbuckets */
+	for (m = 1; m <= nbuckets/2; m *= 2) {
+		/* nothing */
+	}
+
+	b = h % (2*m);
+	if (b >= nbuckets) {
+		b = h % m;
+	}
+	return b;
+}
+
+/*
+ * Read block BLK (counting from 0) of a directory into BUF, and hand
+ * back the number of entries read; the last block of the directory
+ * may be only partly used.
+ */
+static
+int
+sfs_dir_rblock(struct sfs_vnode *sv, uint32_t blk, struct sfs_dir *buf,
+	       unsigned *nret)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, SFS_BLOCKSIZE,
+		  (off_t)blk * SFS_BLOCKSIZE, UIO_READ);
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+	*nret = (SFS_BLOCKSIZE - ku.uio_resid) / sizeof(struct sfs_dir);
+	return 0;
+}
+
+/*
+ * Write all of block BLK of a directory from BUF. This may extend
+ * the directory.
+ */
+static
+int
+sfs_dir_wblock(struct sfs_vnode *sv, uint32_t blk, struct sfs_dir *buf)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, SFS_BLOCKSIZE,
+		  (off_t)blk * SFS_BLOCKSIZE, UIO_WRITE);
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid > 0) {
+		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	}
+	return 0;
+}
+
+/*
+ * Search one block of a directory (block BLK, counting from 0) for
+ * NAME. Reads the whole block at once. On success, hands back the
+ * inode number and slot as sfs_dir_findname does. If EMPTYSLOT is
+ * not null and still -1, sets it to the first free slot seen.
+ */
+static
+int
+sfs_dir_scanblock(struct sfs_vnode *sv, uint32_t blk, const char *name,
+		  uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dir *sds;
+	unsigned i, n;
+	int result;
+
+	/* I/O buffer for a block of directory entries; too big for stack */
+	sds = kmalloc(SFS_BLOCKSIZE);
+	if (sds == NULL) {
+		return ENOMEM;
+	}
+
+	result = sfs_dir_rblock(sv, blk, sds, &n);
+	if (result) {
+		kfree(sds);
+		return result;
+	}
+
+	result = ENOENT;
+	for (i=0; i<n; i++) {
+		if (sds[i].sfd_ino == SFS_NOINO) {
+			if (emptyslot != NULL && *emptyslot < 0) {
+				*emptyslot = blk * SFS_DIRPERBLOCK + i;
+			}
+			continue;
+		}
+		sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+		if (!strcmp(sds[i].sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = blk * SFS_DIRPERBLOCK + i;
+			}
+			if (ino != NULL) {
+				*ino = sds[i].sfd_ino;
+			}
+			result = 0;
+			break;
+		}
+	}
+
+	kfree(sds);
+	return result;
+}
+
+/*
+ * Overflow index for hashed directories (see sfs.h).
+ */
+
+#define SFS_OVINDEX_INITSIZE  16	/* initial number of chains */
+
+/*
+ * Throw away SV's overflow index, if it has one.
+ */
+static
+void
+sfs_ovindex_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_ovindex *oi = sv->sv_ovindex;
+	struct sfs_ovent *oe;
+	unsigned i;
+
+	if (oi == NULL) {
+		return;
+	}
+	for (i=0; i<oi->oi_size; i++) {
+		while ((oe = oi->oi_table[i]) != NULL) {
+			oi->oi_table[i] = oe->oe_next;
+			kfree(oe);
+		}
+	}
+	while ((oe = oi->oi_free) != NULL) {
+		oi->oi_free = oe->oe_next;
+		kfree(oe);
+	}
+	kfree(oi->oi_table);
+	kfree(oi);
+	sv->sv_ovindex = NULL;
+}
+
+/*
+ * Put OE in the index, first doubling the number of chains if they
+ * are getting long. If that fails, the chains just get longer.
+ */
+static
+void
+sfs_ovindex_insert(struct sfs_ovindex *oi, struct sfs_ovent *oe)
+{
+	struct sfs_ovent **newtable, *e;
+	unsigned newsize, i, h;
+
+	if (oi->oi_count >= 2 * oi->oi_size) {
+		newsize = 2 * oi->oi_size;
+		newtable = kmalloc(newsize * sizeof(struct sfs_ovent *));
+		if (newtable != NULL) {
+			for (i=0; i<newsize; i++) {
+				newtable[i] = NULL;
+			}
+			for (i=0; i<oi->oi_size; i++) {
+				while ((e = oi->oi_table[i]) != NULL) {
+					oi->oi_table[i] = e->oe_next;
+					h = e->oe_hash & (newsize - 1);
+					e->oe_next = newtable[h];
+					newtable[h] = e;
+				}
+			}
+			kfree(oi->oi_table);
+			oi->oi_table = newtable;
+			oi->oi_size = newsize;
+		}
+	}
+
+	h = oe->oe_hash & (oi->oi_size - 1);
+	oe->oe_next = oi->oi_table[h];
+	oi->oi_table[h] = oe;
+	oi->oi_count++;
+}
+
+/*
+ * Record that the name with hash H is in overflow slot SLOT.
+ */
+static
+int
+sfs_ovindex_add(struct sfs_ovindex *oi, uint32_t h, uint32_t slot)
+{
+	struct sfs_ovent *oe;
+
+	oe = kmalloc(sizeof(struct sfs_ovent));
+	if (oe == NULL) {
+		return ENOMEM;
+	}
+	oe->oe_hash = h;
+	oe->oe_slot = slot;
+	sfs_ovindex_insert(oi, oe);
+	return 0;
+}
+
+/*
+ * Take the record for the name with hash H in slot SLOT out of the
+ * index and return it, or return NULL if there isn't one.
+ */
+static
+struct sfs_ovent *
+sfs_ovindex_remove(struct sfs_ovindex *oi, uint32_t h, uint32_t slot)
+{
+	struct sfs_ovent **pp, *oe;
+
+	for (pp = &oi->oi_table[h & (oi->oi_size - 1)]; *pp != NULL;
+	     pp = &(*pp)->oe_next) {
+		oe = *pp;
+		if (oe->oe_hash == h && oe->oe_slot == slot) {
+			*pp = oe->oe_next;
+			oi->oi_count--;
+			return oe;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put OE, whose oe_slot is now free, on the free list.
+ */
+static
+void
+sfs_ovindex_putfree(struct sfs_ovindex *oi, struct sfs_ovent *oe)
+{
+	oe->oe_next = oi->oi_free;
+	oi->oi_free = oe;
+}
+
+/*
+ * Take a free overflow slot from the free list. Returns -1 if none.
+ */
+static
+int
+sfs_ovindex_getfree(struct sfs_ovindex *oi)
+{
+	struct sfs_ovent *oe;
+	int slot;
+
+	oe = oi->oi_free;
+	if (oe == NULL) {
+		return -1;
+	}
+	oi->oi_free = oe->oe_next;
+	slot = oe->oe_slot;
+	kfree(oe);
+	return slot;
+}
+
+/*
+ * Drop the free slots in directory block BLK from the free list.
+ */
+static
+void
+sfs_ovindex_dropfree(struct sfs_ovindex *oi, uint32_t blk)
+{
+	struct sfs_ovent **pp, *oe;
+
+	pp = &oi->oi_free;
+	while (*pp != NULL) {
+		oe = *pp;
+		if (oe->oe_slot / SFS_DIRPERBLOCK == blk) {
+			*pp = oe->oe_next;
+			kfree(oe);
+		}
+		else {
+			pp = &oe->oe_next;
+		}
+	}
+}
+
+/*
+ * Build SV's overflow index from disk, unless it already has one.
+ * Reads each overflow block once.
+ */
+static
+int
+sfs_ovindex_load(struct sfs_vnode *sv)
+{
+	struct sfs_ovindex *oi;
+	struct sfs_ovent *oe;
+	struct sfs_dir *sds;
+	uint32_t blk, nblocks, slot;
+	unsigned i, n;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_ovindex != NULL) {
+		return 0;
+	}
+
+	oi = kmalloc(sizeof(struct sfs_ovindex));
+	if (oi == NULL) {
+		return ENOMEM;
+	}
+	oi->oi_table = kmalloc(SFS_OVINDEX_INITSIZE *
+			       sizeof(struct sfs_ovent *));
+	if (oi->oi_table == NULL) {
+		kfree(oi);
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_OVINDEX_INITSIZE; i++) {
+		oi->oi_table[i] = NULL;
+	}
+	oi->oi_size = SFS_OVINDEX_INITSIZE;
+	oi->oi_count = 0;
+	oi->oi_free = NULL;
+	sv->sv_ovindex = oi;
+
+	sds = kmalloc(SFS_BLOCKSIZE);
+	if (sds == NULL) {
+		sfs_ovindex_destroy(sv);
+		return ENOMEM;
+	}
+
+	nblocks = DIVROUNDUP(sfs_dir_nentries(sv), SFS_DIRPERBLOCK);
+	for (blk = sv->sv_i.sfi_dirbuckets; blk < nblocks; blk++) {
+		result = sfs_dir_rblock(sv, blk, sds, &n);
+		if (result) {
+			goto fail;
+		}
+		for (i=0; i<n; i++) {
+			slot = blk * SFS_DIRPERBLOCK + i;
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				oe = kmalloc(sizeof(struct sfs_ovent));
+				if (oe == NULL) {
+					result = ENOMEM;
+					goto fail;
+				}
+				oe->oe_slot = slot;
+				sfs_ovindex_putfree(oi, oe);
+				continue;
+			}
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+			result = sfs_ovindex_add(oi,
+						 sfs_dirhash(sds[i].sfd_name),
+						 slot);
+			if (result) {
+				goto fail;
+			}
+		}
+	}
+
+	kfree(sds);
+	return 0;
+
+ fail:
+	kfree(sds);
+	sfs_ovindex_destroy(sv);
+	return result;
+}
+
+/*
+ * sfs_dir_findname for hashed directories. Only the name's bucket is
+ * read; names in the overflow area are found through the overflow
+ * index. EMPTYSLOT only ever reports a free slot in the bucket.
+ */
+static
+int
+sfs_hdir_findname(struct sfs_vnode *sv, const char *name,
+		  uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t nbuckets = sv->sv_i.sfi_dirbuckets;
+	struct sfs_ovent *oe;
+	struct sfs_dir sd;
+	uint32_t h;
+	int result;
+
+	if ((uint32_t)sfs_dir_nentries(sv) < nbuckets * SFS_DIRPERBLOCK) {
+		kprintf("sfs: %s: hashed directory %u: size %u too small "
+			"for %u buckets\n", sfs->sfs_super.sp_volname,
+			sv->sv_ino, sv->sv_i.sfi_size, nbuckets);
+		return EIO;
+	}
+
+	if (emptyslot != NULL) {
+		*emptyslot = -1;
+	}
+
+	h = sfs_dirhash(name);
+	result = sfs_dir_scanblock(sv, sfs_dirbucket(h, nbuckets), name,
+				   ino, slot, emptyslot);
+	if (result != ENOENT) {
+		return result;
+	}
+
+	result = sfs_ovindex_load(sv);
+	if (result) {
+		return result;
+	}
+
+	for (oe = sv->sv_ovindex->oi_table[h & (sv->sv_ovindex->oi_size-1)];
+	     oe != NULL; oe = oe->oe_next) {
+		if (oe->oe_hash != h) {
+			continue;
+		}
+		result = sfs_readdir(sv, &sd, oe->oe_slot);
+		if (result) {
+			return result;
+		}
+		sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+		if (sd.sfd_ino != SFS_NOINO && !strcmp(sd.sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = oe->oe_slot;
+			}
+			if (ino != NULL) {
+				*ino = sd.sfd_ino;
+			}
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+/*
+ * Add a bucket to hashed directory SV by splitting bucket n - m (see
+ * kern/sfs.h). The writes are ordered so that a crash part way
+ * through can leave a name in two slots but never loses one: names
+ * leaving block n are copied to their new places first, then the new
+ * bucket is written, then the inode, and only then are the names
+ * that moved taken out of the split bucket.
+ */
+static
+int
+sfs_hdir_split(struct sfs_vnode *sv)
+{
+	struct sfs_ovindex *oi;
+	struct sfs_ovent *oe;
+	struct sfs_dir *buf, *sb, *ob, *nb;
+	bool moved[SFS_DIRPERBLOCK];
+	bool sbchanged = false;
+	uint32_t n = sv->sv_i.sfi_dirbuckets;
+	uint32_t m, s, b, h, nblocks, end;
+	unsigned i, j, nn, got;
+	int slot, result;
+
+	for (m = 1; m <= n/2; m *= 2) {
+		/* nothing */
+	}
+	s = n - m;
+
+	result = sfs_ovindex_load(sv);
+	if (result) {
+		return result;
+	}
+	oi = sv->sv_ovindex;
+
+	/* the split bucket, old block n, and the new bucket */
+	buf = kmalloc(3 * SFS_BLOCKSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	bzero(buf, 3 * SFS_BLOCKSIZE);
+	sb = buf;
+	ob = sb + SFS_DIRPERBLOCK;
+	nb = ob + SFS_DIRPERBLOCK;
+
+	nblocks = DIVROUNDUP(sfs_dir_nentries(sv), SFS_DIRPERBLOCK);
+	end = sfs_dir_nentries(sv);
+	if (end < (n+1) * SFS_DIRPERBLOCK) {
+		end = (n+1) * SFS_DIRPERBLOCK;
+	}
+
+	result = sfs_dir_rblock(sv, s, sb, &got);
+	if (result) {
+		goto fail;
+	}
+	if (n < nblocks) {
+		result = sfs_dir_rblock(sv, n, ob, &got);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	/* Block n stops being overflow */
+	sfs_ovindex_dropfree(oi, n);
+
+	/* Names in the split bucket that now hash to the new one */
+	nn = 0;
+	for (i=0; i<SFS_DIRPERBLOCK; i++) {
+		moved[i] = false;
+		if (sb[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		sb[i].sfd_name[sizeof(sb[i].sfd_name)-1] = 0;
+		if (sfs_dirbucket(sfs_dirhash(sb[i].sfd_name), n+1) == n) {
+			nb[nn++] = sb[i];
+			moved[i] = true;
+		}
+	}
+
+	/* Find new places for the names in old block n */
+	for (j=0; j<SFS_DIRPERBLOCK; j++) {
+		if (ob[j].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		ob[j].sfd_name[sizeof(ob[j].sfd_name)-1] = 0;
+		h = sfs_dirhash(ob[j].sfd_name);
+		oe = sfs_ovindex_remove(oi, h, n * SFS_DIRPERBLOCK + j);
+		if (oe != NULL) {
+			kfree(oe);
+		}
+
+		b = sfs_dirbucket(h, n+1);
+		if (b == n && nn < SFS_DIRPERBLOCK) {
+			nb[nn++] = ob[j];
+			continue;
+		}
+		if (b == s) {
+			for (i=0; i<SFS_DIRPERBLOCK; i++) {
+				if (sb[i].sfd_ino == SFS_NOINO && !moved[i]) {
+					break;
+				}
+			}
+			if (i < SFS_DIRPERBLOCK) {
+				sb[i] = ob[j];
+				sbchanged = true;
+				continue;
+			}
+		}
+
+		/* Back to the overflow area, past block n */
+		slot = sfs_ovindex_getfree(oi);
+		if (slot < 0) {
+			slot = end++;
+		}
+		result = sfs_writedir(sv, &ob[j], slot);
+		if (result) {
+			goto fail;
+		}
+		result = sfs_ovindex_add(oi, h, slot);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	if (sbchanged) {
+		result = sfs_dir_wblock(sv, s, sb);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	result = sfs_dir_wblock(sv, n, nb);
+	if (result) {
+		goto fail;
 	}
 
-	/* We should not hit EOF in the middle of a directory entry */
-	if (ku.uio_resid > 0) {
-		panic("sfs: readdir: Short entry (inode %u)\n", sv->sv_ino);
+	sv->sv_i.sfi_dirbuckets = n+1;
+	sv->sv_dirty = true;
+
+	if (nn > 0) {
+		for (i=0; i<SFS_DIRPERBLOCK; i++) {
+			if (moved[i]) {
+				bzero(&sb[i], sizeof(sb[i]));
+			}
+		}
+		result = sfs_dir_wblock(sv, s, sb);
+		if (result) {
+			goto fail;
+		}
 	}
 
-	/* Done */
+	kfree(buf);
 	return 0;
+
+ fail:
+	/* The index may not match the disk any more; rebuild it later */
+	sfs_ovindex_destroy(sv);
+	kfree(buf);
+	return result;
 }
 
 /*
- * Write (overwrite) the directory entry in slot SLOT of a directory
- * vnode.
+ * Find a slot for NAME, which is not in hashed directory SV and
+ * whose bucket is full. Splits a bucket first, which may make room.
+ * Otherwise uses a free overflow slot, or the end of the directory.
  */
 static
 int
-sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+sfs_hdir_makeroom(struct sfs_vnode *sv, const char *name, int *slot)
 {
-	struct iovec iov;
-	struct uio ku;
-	off_t actualpos;
 	int result;
 
-	/* Compute the actual position in the directory. */
-	KASSERT(slot>=0);
-	actualpos = slot * sizeof(struct sfs_dir);
-
-	/* Set up a uio to do the write */ 
-	uio_kinit(&iov, &ku, sd, sizeof(struct sfs_dir), actualpos, UIO_WRITE);
-
-	/* do it */
-	result = sfs_io(sv, &ku);
+	result = sfs_hdir_split(sv);
 	if (result) {
 		return result;
 	}
 
-	/* Should not end up with a partial entry! */
-	if (ku.uio_resid > 0) {
-		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	*slot = -1;
+	result = sfs_dir_scanblock(sv, sfs_dirbucket(sfs_dirhash(name),
+						     sv->sv_i.sfi_dirbuckets),
+				   name, NULL, NULL, slot);
+	if (result != ENOENT) {
+		/* the name can't be there, so this is an error */
+		KASSERT(result != 0);
+		return result;
 	}
-
-	/* Done */
-	return 0;
-}
-
-/*
- * Compute the number of entries in a directory.
- * This actually computes the number of existing slots, and does not
- * account for empty slots.
- */
-static
-int
-sfs_dir_nentries(struct sfs_vnode *sv)
-{
-	off_t size;
-
-	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
-
-	size = sv->sv_i.sfi_size;
-	if (size % sizeof(struct sfs_dir) != 0) {
-		panic("sfs: directory %u: Invalid size %llu\n",
-		      sv->sv_ino, size);
+	if (*slot >= 0) {
+		return 0;
 	}
 
-	return size / sizeof(struct sfs_dir);
+	result = sfs_ovindex_load(sv);
+	if (result) {
+		return result;
+	}
+	*slot = sfs_ovindex_getfree(sv->sv_ovindex);
+	if (*slot < 0) {
+		*slot = sfs_dir_nentries(sv);
+	}
+	return 0;
 }
 
 /*
@@ -652,6 +1801,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	int nentries = sfs_dir_nentries(sv);
 	int i, result;
 
+	if (sv->sv_i.sfi_dirbuckets != 0) {
+		return sfs_hdir_findname(sv, name, ino, slot, emptyslot);
+	}
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -713,8 +1866,18 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
-	if (emptyslot < 0) {
+	/*
+	 * If we didn't get an empty slot, add the entry at the end. A
+	 * hashed directory only reports a free slot in the name's
+	 * bucket; if there isn't one, split a bucket to make room.
+	 */
+	if (emptyslot < 0 && sv->sv_i.sfi_dirbuckets != 0) {
+		result = sfs_hdir_makeroom(sv, name, &emptyslot);
+		if (result) {
+			return result;
+		}
+	}
+	else if (emptyslot < 0) {
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -728,26 +1891,60 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		*slot = emptyslot;
 	}
 
+	/* Any cached negative entry for the name is now wrong. */
+	vfs_ncache_remove(&sv->sv_v, name);
+
 	/* Write the entry. */
-	return sfs_writedir(sv, &sd, emptyslot);
-	
+	result = sfs_writedir(sv, &sd, emptyslot);
+	if (result) {
+		return result;
+	}
+
+	/* Keep the overflow index up to date */
+	if (sv->sv_ovindex != NULL && (uint32_t)emptyslot >=
+	    sv->sv_i.sfi_dirbuckets * SFS_DIRPERBLOCK) {
+		if (sfs_ovindex_add(sv->sv_ovindex, sfs_dirhash(name),
+				    emptyslot)) {
+			sfs_ovindex_destroy(sv);
+		}
+	}
+	return 0;
 }
 
 /*
- * Unlink a name in a directory, by slot number.
+ * Unlink a name in a directory, by slot number. NAME must be the
+ * name stored in that slot; it is used to update the name cache.
  */
 static
 int
-sfs_dir_unlink(struct sfs_vnode *sv, int slot)
+sfs_dir_unlink(struct sfs_vnode *sv, const char *name, int slot)
 {
+	struct sfs_ovent *oe;
 	struct sfs_dir sd;
+	int result;
+
+	vfs_ncache_remove(&sv->sv_v, name);
 
 	/* Initialize a suitable directory entry... */ 
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, &sd, slot);
+	result = sfs_writedir(sv, &sd, slot);
+	if (result) {
+		return result;
+	}
+
+	/* An overflow slot goes from the index to the free list */
+	if (sv->sv_ovindex != NULL &&
+	    (uint32_t)slot >= sv->sv_i.sfi_dirbuckets * SFS_DIRPERBLOCK) {
+		oe = sfs_ovindex_remove(sv->sv_ovindex, sfs_dirhash(name),
+					slot);
+		if (oe != NULL) {
+			sfs_ovindex_putfree(sv->sv_ovindex, oe);
+		}
+	}
+	return 0;
 }
 
 /*
@@ -801,7 +1998,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, NULL, false, false, &ino);
 	if (result) {
 		return result;
 	}
@@ -875,8 +2072,12 @@ static
 int
 sfs_close(struct vnode *v)
 {
-	/* Sync it. */
-	return VOP_FSYNC(v);
+	/*
+	 * Sync it, but don't commit; close doesn't promise the file
+	 * is on disk, and this way the inode goes out with whatever
+	 * else gets committed next.
+	 */
+	return sfs_syncvnode(v->vn_data);
 }
 
 /*
@@ -890,31 +2091,40 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sfs->sfs_vnlock);
+
+	KASSERT(!sv->sv_idle);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. sfs_loadvnode only hands
+	 * out references while holding sfs_vnlock, so if the count is
+	 * still 1 now, nobody else can get at the vnode; that's why
+	 * we don't need sv_lock below.
 	 */
+	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
 		KASSERT(v->vn_refcount>1);
 		v->vn_refcount--;
 
-		vfs_biglock_release();
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	spinlock_release(&v->vn_countlock);
+
+	/* Give back blocks reserved for writes that never came */
+	sfs_prealloc_release(sfs, sv);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
 			return result;
 		}
 	}
@@ -922,38 +2132,38 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
-	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
-		sfs_bfree(sfs, sv->sv_ino);
-	}
-
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
+	/*
+	 * If the file still exists, keep the vnode around on the idle
+	 * list; the reference VOP_DECREF gave us now belongs to the
+	 * cache. Trim the cache if it grew too large.
+	 *
+	 * Trimming is best-effort: this vnode has been reclaimed
+	 * into the cache either way, so a failure here (which just
+	 * leaves some other idle vnode cached a while longer) must
+	 * not be reported as a failure to reclaim.
+	 */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		sfs_lru_add(sfs, sv);
+		result = sfs_vcache_trim(sfs, SFS_VCACHE_MAX);
+		if (result) {
+			kprintf("sfs: %s: trimming vnode cache: %s\n",
+				sfs->sfs_super.sp_volname, strerror(result));
 		}
+		lock_release(sfs->sfs_vnlock);
+		return 0;
 	}
-	if (ix == num) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
 
-	VOP_CLEANUP(&sv->sv_v);
+	/* No on-disk references; discard the inode */
+	sfs_bfree(sfs, sv->sv_ino);
 
-	vfs_biglock_release();
+	/* Remove the vnode from the table and destroy it. */
+	sfs_destroyvnode(sfs, sv);
 
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	lock_release(sfs->sfs_vnlock);
 
 	/* Done */
 	return 0;
@@ -971,9 +2181,9 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -990,9 +2200,9 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -1015,6 +2225,20 @@ sfs_ioctl(struct vnode *v, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Called for poll(). Disk files never block.
+ */
+static
+int
+sfs_poll(struct vnode *v, int events, struct pollwait *pw, int *revents)
+{
+	(void)v;
+	(void)pw;
+
+	*revents = poll_alwaysready(events);
+	return 0;
+}
+
 /*
  * Called for stat/fstat/lstat.
  */
@@ -1033,7 +2257,9 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
+	lock_release(sv->sv_lock);
 
 	/* We don't support these yet; you get to implement them */
 	statbuf->st_nlink = 0;
@@ -1053,16 +2279,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes once the vnode is loaded; no lock */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -1091,6 +2314,23 @@ sfs_tryseek(struct vnode *v, off_t pos)
 	return 0;
 }
 
+/*
+ * Write SV's inode into the running journal transaction (or to disk,
+ * if there's no journal) without committing it. sfs_sync uses this
+ * so all the inodes get committed together.
+ */
+int
+sfs_syncvnode(struct sfs_vnode *sv)
+{
+	int result;
+
+	lock_acquire(sv->sv_lock);
+	result = sfs_sync_inode(sv);
+	lock_release(sv->sv_lock);
+
+	return result;
+}
+
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
@@ -1100,13 +2340,16 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
-	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	result = sfs_syncvnode(sv);
+	if (result) {
+		return result;
+	}
 
-	return result;
+	/* File data is written in place; commit the metadata */
+	return sfs_jcommit(sfs);
 }
 
 /*
@@ -1121,35 +2364,113 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Discard the part of an indirect block tree past the new end of a
+ * file being truncated.
+ *
+ * *IDBLOCKP is the root of a tree with LEVELS levels of indirection,
+ * mapping file blocks starting from BASE. Free every data block at or
+ * past BLOCKLEN, and every indirect block left with nothing in it. If
+ * the root itself ends up empty, free it and clear *IDBLOCKP.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_discard_indirect(struct sfs_fs *sfs, uint32_t *idblockp, unsigned levels,
+		     uint32_t base, uint32_t blocklen)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	uint32_t *idbuf;
+	uint32_t span, i, j, old;
+	int hasnonzero, iddirty;
+	int result;
 
-	struct sfs_vnode *sv = v->vn_data;
+	KASSERT(levels >= 1 && levels <= 3);
+
+	if (*idblockp == 0) {
+		return 0;
+	}
+
+	/* Number of file blocks mapped by each entry */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	if (base + span*SFS_DBPERIDB <= blocklen) {
+		/* The whole tree is before the new EOF */
+		return 0;
+	}
+
+	/* I/O buffer for the indirect block; too big for the stack */
+	idbuf = kmalloc(SFS_BLOCKSIZE);
+	if (idbuf == NULL) {
+		return ENOMEM;
+	}
+
+	result = sfs_rblock(sfs, idbuf, *idblockp);
+	if (result) {
+		goto out;
+	}
+
+	hasnonzero = 0;
+	iddirty = 0;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		old = idbuf[j];
+		if (old != 0 && levels > 1) {
+			result = sfs_discard_indirect(sfs, &idbuf[j], levels-1,
+						      base + j*span, blocklen);
+			if (result) {
+				goto out;
+			}
+		}
+		else if (old != 0 && base+j >= blocklen) {
+			/* Data block past the new EOF */
+			sfs_bfree(sfs, old);
+			idbuf[j] = 0;
+		}
+		if (idbuf[j] != old) {
+			iddirty = 1;
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = 1;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, *idblockp);
+		*idblockp = 0;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty; write it back */
+		lock_acquire(sfs->sfs_idlock);
+		sfs_idforget(sfs, *idblockp);
+		lock_release(sfs->sfs_idlock);
+		result = sfs_jwblock(sfs, idbuf, *idblockp);
+	}
+
+ out:
+	kfree(idbuf);
+	return result;
+}
+
+/*
+ * Truncate a file to LEN bytes. The caller must hold sv_lock, or be
+ * sfs_reclaim.
+ */
+static
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j, block;
-	uint32_t idblock, baseblock, highblock;
+	uint32_t i, block, base;
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
-	vfs_biglock_acquire();
+	/* Drop any preallocated blocks; we're not growing */
+	sfs_prealloc_release(sfs, sv);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1164,54 +2485,27 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			vfs_biglock_release();
-			return result;
-		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+	/*
+	 * Now the single, double, and triple indirect trees. These
+	 * may clear the inode's pointers; the inode gets marked dirty
+	 * below in any event.
+	 */
+	base = SFS_NDIRECT;
+	result = sfs_discard_indirect(sfs, &sv->sv_i.sfi_indirect, 1,
+				      base, blocklen);
+	if (result == 0) {
+		base += SFS_DBPERIDB;
+		result = sfs_discard_indirect(sfs, &sv->sv_i.sfi_dindirect, 2,
+					      base, blocklen);
+	}
+	if (result == 0) {
+		base += SFS_DBPERIDB*SFS_DBPERIDB;
+		result = sfs_discard_indirect(sfs, &sv->sv_i.sfi_tindirect, 3,
+					      base, blocklen);
+	}
+	if (result) {
+		sv->sv_dirty = true;
+		return result;
 	}
 
 	/* Set the file size */
@@ -1220,10 +2514,26 @@ sfs_truncate(struct vnode *v, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	lock_release(sv->sv_lock);
+
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1259,18 +2569,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -1278,18 +2588,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_v;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -1300,19 +2610,21 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_v);
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_v;
 	
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -1331,20 +2643,27 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
+	/* Linking the directory into itself would deadlock below */
+	if (f == sv) {
+		return EINVAL;
+	}
+
+	lock_acquire(sv->sv_lock);
 
 	/* Just create a link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -1360,28 +2679,34 @@ sfs_remove(struct vnode *dir, const char *name)
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* Erase its directory entry. */
-	result = sfs_dir_unlink(sv, slot);
+	result = sfs_dir_unlink(sv, name, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		if (victim != sv) {
+			lock_acquire(victim->sv_lock);
+		}
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		if (victim != sv) {
+			lock_release(victim->sv_lock);
+		}
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_v);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return result;
 }
 
@@ -1401,21 +2726,23 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* We don't support subdirectories */
 	KASSERT(g1->sv_i.sfi_type == SFS_TYPE_FILE);
 
+	lock_acquire(g1->sv_lock);
+
 	/*
 	 * Link it under the new name.
 	 *
@@ -1433,8 +2760,16 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
 
+	/* Adding the name may have split a bucket and moved the old one */
+	if (sv->sv_i.sfi_dirbuckets != 0) {
+		result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+		if (result) {
+			goto puke_harder;
+		}
+	}
+
 	/* Unlink the old slot */
-	result = sfs_dir_unlink(sv, slot1);
+	result = sfs_dir_unlink(sv, n1, slot1);
 	if (result) {
 		goto puke_harder;
 	}
@@ -1448,16 +2783,17 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_dirty = true;
 
 	/* Let go of the reference to g1 */
+	lock_release(g1->sv_lock);
 	VOP_DECREF(&g1->sv_v);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 
  puke_harder:
 	/*
 	 * Error recovery: try to undo what we already did
 	 */
-	result2 = sfs_dir_unlink(sv, slot2);
+	result2 = sfs_dir_unlink(sv, n2, slot2);
 	if (result2) {
 		kprintf("sfs: rename: %s\n", strerror(result));
 		kprintf("sfs: rename: while cleaning up: %s\n", 
@@ -1467,8 +2803,9 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount--;
  puke:
 	/* Let go of the reference to g1 */
+	lock_release(g1->sv_lock);
 	VOP_DECREF(&g1->sv_v);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return result;
 }
 
@@ -1486,15 +2823,12 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes, and we touch nothing else; no lock */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -1502,7 +2836,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_v);
 	*ret = &sv->sv_v;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -1510,7 +2843,8 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
  * Lookup gets a vnode for a pathname.
  *
  * Since we don't support subdirectories, it's easy - just look up the
- * name.
+ * name. Check the name cache first, and remember what we find,
+ * including names that don't exist.
  */
 static
 int
@@ -1518,24 +2852,41 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_vnode *final;
+	struct vnode *cached;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
+
+	/*
+	 * Hold the directory lock while consulting and updating the
+	 * cache, so an entry can't go in after the name was changed.
+	 */
+	lock_acquire(sv->sv_lock);
+
+	if (vfs_ncache_lookup(v, path, &cached)) {
+		lock_release(sv->sv_lock);
+		if (cached == NULL) {
+			return ENOENT;
+		}
+		*ret = cached;
+		return 0;
+	}
 	
 	result = sfs_lookonce(sv, path, &final, NULL);
+	if (result == ENOENT) {
+		vfs_ncache_enter(v, path, NULL);
+	}
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
+	vfs_ncache_enter(v, path, &final->sv_v);
 	*ret = &final->sv_v;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -1587,6 +2938,7 @@ static const struct vnode_ops sfs_fileops = {
 	NOTDIR,  /* getdirentry */
 	sfs_write,
 	sfs_ioctl,
+	sfs_poll,
 	sfs_stat,
 	sfs_gettype,
 	sfs_tryseek,
@@ -1622,6 +2974,7 @@ static const struct vnode_ops sfs_dirops = {
 	UNIMP,   /* getdirentry */
 	ISDIR,   /* write */
 	sfs_ioctl,
+	sfs_poll,
 	sfs_stat,
 	sfs_gettype,
 	UNIMP,   /* tryseek */
@@ -1644,49 +2997,55 @@ static const struct vnode_ops sfs_dirops = {
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Takes sfs_vnlock.
  */
 static
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops = NULL;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vhash_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* May only be set when creating new objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* May only be set when creating new objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
+		if (sv->sv_idle) {
+			/* Take over the reference the idle list held */
+			sfs_lru_remove(sfs, sv);
+		}
+		else {
 			VOP_INCREF(&sv->sv_v);
-			*ret = sv;
-			return 0;
 		}
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
+	sv->sv_lock = lock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -1699,13 +3058,21 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* Start looking for data blocks just past the inode */
+	sv->sv_goal = ino + 1;
+	sv->sv_pastart = 0;
+	sv->sv_palen = 0;
+	sv->sv_ovindex = NULL;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out and thus the type
@@ -1736,20 +3103,22 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_hashnext = NULL;
+	sv->sv_idle = false;
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
-	if (result) {
-		VOP_CLEANUP(&sv->sv_v);
-		kfree(sv);
-		return result;
-	}
+	sfs_vhash_add(sfs, sv);
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -1767,14 +3136,10 @@ sfs_getroot(struct fs *fs)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOT_LOCATION, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		panic("sfs: getroot: Cannot load root vnode\n");
 	}
 
-	vfs_biglock_release();
-
 	return &sv->sv_v;
 }
@@ -38,8 +38,9 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU once every timer tick (every
+ * LT_GRANULARITY usec) to allow simple timed operations: it wakes
+ * the threads in clocksleep() and clocknap() whose time is up.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -36,6 +36,19 @@
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of scheduling priority levels. Each cpu has one run queue
+ * per level; level 0 is the highest priority. See schedule() in
+ * thread.c.
+ */
+#define SCHED_NLEVELS	4
+
+/* Load averages (c_loadavg) are fixed-point with this many fraction bits. */
+#define SCHED_LOADSHIFT	8
+
+/* Most dead threads (with their stacks) each cpu keeps for reuse. */
+#define THREAD_CACHE_MAX	8
+
 /*
  * Per-cpu structure
  *
@@ -59,14 +72,18 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Dead threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_lastboost;		/* c_hardclocks at last priority boost */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues by level */
+	unsigned c_runcount;		/* Total threads in c_runqueue[] */
+	unsigned c_loadavg;		/* Decayed load (only this cpu writes) */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -37,6 +37,53 @@
 #include <fs.h>
 #include <vnode.h>
 
+struct lock;
+
+/*
+ * Client-side caching.
+ *
+ * File data is cached a page at a time in a pool of EMUFS_NPAGES
+ * pages shared by all the vnodes of the filesystem and recycled in
+ * least-recently-used order. A page with ep_len less than PAGE_SIZE
+ * holds the end of the file. Each vnode also caches its file size.
+ * Writes and truncates go straight to the host and drop the pages
+ * of the vnode they were done through.
+ *
+ * The host gives out a new handle (and so we make a new vnode) every
+ * time a file is opened, so there can be several vnodes for the same
+ * file, and we can't tell which. Writes through one of them (or by
+ * the host) aren't seen in the others' caches right away. Instead,
+ * like NFS, we give close-to-open consistency: opening a vnode asks
+ * the host for the file size and, if it isn't what we have cached,
+ * throws the vnode's cached pages away. Otherwise the cache is kept,
+ * so running the same program over and over only costs one host
+ * request per exec. The device reports no modification time, so a
+ * change on the host that leaves the size alone goes unnoticed until
+ * the pages age out of the cache.
+ *
+ * Lookups go through the VFS name cache, which keeps the vnodes for
+ * recently used names (and their host handles) around. A handle
+ * keeps referring to the file it was opened on even if the name is
+ * replaced on the host, so a cached name older than EMUFS_LOOKUP_TTL
+ * seconds is looked up on the host again before it's used (see
+ * emufs_revalidate). Creates always go to the host.
+ *
+ * Each vnode's ev_lock serializes I/O on it and protects its cached
+ * size and read position. ef_cachelock only protects the page pool
+ * and is held briefly. The order is ev_lock, then ef_cachelock, then
+ * the device's e_lock.
+ */
+#define EMUFS_NPAGES  32		/* pages of file data cached */
+#define EMUFS_LOOKUP_TTL  1		/* seconds to trust a cached name */
+
+struct emufs_page {
+	struct emufs_vnode *ep_vn;	/* file cached, or NULL if unused */
+	off_t ep_offset;		/* page-aligned offset in file */
+	uint32_t ep_len;		/* valid bytes */
+	unsigned ep_stamp;		/* time of last use, for LRU */
+	char *ep_data;			/* PAGE_SIZE bytes */
+};
+
 /*
  * Our structures
  */
@@ -45,6 +92,11 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	struct lock *ev_lock;		/* lock for I/O and the fields below */
+	bool ev_sizevalid;		/* true if ev_size is cached */
+	off_t ev_size;			/* file size */
+	off_t ev_readnext;		/* where a sequential read goes next */
+	time_t ev_looktime;		/* when the name was last checked */
 };
 
 struct emufs_fs {
@@ -52,6 +104,9 @@ struct emufs_fs {
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct lock *ef_cachelock;	/* lock for the page pool */
+	unsigned ef_pageclock;		/* LRU clock for ef_pages */
+	struct emufs_page ef_pages[EMUFS_NPAGES]; /* cached file data */
 };
 
 
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * poll.h
+ */
+
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+#include <kern/limits.h>
+
+/*
+ * Definitions for poll() and select(), for <poll.h> and
+ * <sys/select.h>.
+ */
+
+struct pollfd {
+	int fd;			/* file handle; ignored if negative */
+	short events;		/* events of interest */
+	short revents;		/* events that occurred */
+};
+
+/* Event bits for poll */
+#define POLLIN		0x0001	/* can read without blocking */
+#define POLLPRI		0x0002	/* urgent data (unused) */
+#define POLLOUT		0x0004	/* can write without blocking */
+#define POLLERR		0x0008	/* error (always reported) */
+#define POLLHUP		0x0010	/* other end hung up (always reported) */
+#define POLLNVAL	0x0020	/* not an open file (always reported) */
+#define POLLRDNORM	0x0040	/* same as POLLIN */
+#define POLLWRNORM	0x0080	/* same as POLLOUT */
+
+/*
+ * Descriptor sets for select. Note that there is no FD_SET etc. here;
+ * those are in userlevel <sys/select.h>.
+ */
+#define __FD_SETSIZE	__OPEN_MAX
+#define __NFDBITS	32
+
+struct __fd_set {
+	__u32 __fds_bits[(__FD_SETSIZE + __NFDBITS - 1) / __NFDBITS];
+};
+
+#endif /* _KERN_POLL_H_ */
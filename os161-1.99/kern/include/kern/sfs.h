@@ -71,7 +71,9 @@ struct sfs_super {
 	uint32_t sp_magic;		/* Magic number, should be SFS_MAGIC */
 	uint32_t sp_nblocks;			/* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];
+	uint32_t sp_journalstart;		/* First block of journal */
+	uint32_t sp_journalblocks;		/* Journal size, 0 if none */
+	uint32_t reserved[116];
 };
 
 /*
@@ -83,9 +85,16 @@ struct sfs_inode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dirbuckets;		/* # hash buckets (dirs only) */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_waste[128-6-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
+/* Tell tools (e.g. sfsck) that the inode has these fields */
+#define HAS_DIDIRECT
+#define HAS_TIDIRECT
+
 /*
  * On-disk directory entry
  */
@@ -94,5 +103,83 @@ struct sfs_dir {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/* Number of directory entries in a block */
+#define SFS_DIRPERBLOCK   (SFS_BLOCKSIZE / sizeof(struct sfs_dir))
+
+/*
+ * Hashed directories.
+ *
+ * A directory is always an array of struct sfs_dir, and may always
+ * be read as such. If sfi_dirbuckets is nonzero, however, the first
+ * sfi_dirbuckets blocks of the directory are hash buckets: an entry
+ * stored there must be in its name's bucket. Entries that don't fit
+ * in their bucket go in the overflow area, which is everything past
+ * the buckets and is unordered. The directory size is never less
+ * than sfi_dirbuckets blocks.
+ *
+ * The hash is 32-bit FNV-1a over the bytes of the name: start with
+ * SFS_DIRHASH_INIT and apply SFS_DIRHASH_STEP for each character.
+ *
+ * Buckets are assigned by linear hashing, so the directory can grow
+ * one bucket at a time. With n buckets, let m be the largest power
+ * of two not greater than n. A name's bucket is hash % 2m, or, if
+ * that is n or more, hash % m. Adding bucket n splits bucket n - m:
+ * the names there whose bucket is now n move to the new bucket,
+ * block n. Whatever was in block n (which was overflow) is moved to
+ * the new bucket, the split bucket, or the end of the directory.
+ * The kernel splits a bucket whenever a new name finds its bucket
+ * full. A crash in the middle of a split can leave a name in the
+ * directory twice; sfsck merges the copies.
+ */
+#define SFS_DIRHASH_INIT        2166136261U
+#define SFS_DIRHASH_STEP(h, c)  (((h) ^ (unsigned char)(c)) * 16777619U)
+
+/*
+ * Metadata journal.
+ *
+ * If sp_journalblocks is nonzero, that many blocks starting at
+ * sp_journalstart hold a log of metadata updates (inodes, directory
+ * blocks, indirect blocks, and the freemap). The first block is a
+ * struct sfs_jheader; the rest of the journal is filled from the
+ * front with transactions. Each transaction is a struct sfs_jdesc
+ * naming the blocks it updates, then the new contents of those
+ * blocks in the same order, then a struct sfs_jcommit. Transactions
+ * are numbered consecutively starting from jh_seq; a transaction
+ * only counts if its descriptor and commit record both carry the
+ * expected number and jc_sum matches the sum of the 32-bit words of
+ * the block images. Replaying the journal means copying the blocks
+ * of each complete transaction, in order, to their real locations,
+ * and then setting jh_seq past the last one to empty the journal.
+ */
+#define SFS_JMAGIC        0x4a524e4c    /* magic number for sfs_jheader */
+#define SFS_JDESC_MAGIC   0x4a445343    /* magic number for sfs_jdesc */
+#define SFS_JCOMMIT_MAGIC 0x4a434d54    /* magic number for sfs_jcommit */
+#define SFS_JOURNALSIZE   128           /* default journal size (blocks) */
+#define SFS_JMAXTX        32            /* max blocks in a transaction */
+
+/* Smallest useful journal: header plus one full transaction */
+#define SFS_JMINSIZE      (1 + SFS_JMAXTX + 2)
+
+struct sfs_jheader {
+	uint32_t jh_magic;		/* Magic number, should be SFS_JMAGIC */
+	uint32_t jh_seq;		/* Number of first transaction in log */
+	uint32_t reserved[126];
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;		/* Should be SFS_JDESC_MAGIC */
+	uint32_t jd_seq;		/* Transaction number */
+	uint32_t jd_nblocks;		/* Number of blocks in transaction */
+	uint32_t jd_blocks[125];	/* Where they go */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;		/* Should be SFS_JCOMMIT_MAGIC */
+	uint32_t jc_seq;		/* Transaction number */
+	uint32_t jc_nblocks;		/* Number of blocks in transaction */
+	uint32_t jc_sum;		/* Sum of the block images */
+	uint32_t reserved[124];
+};
+
 
 #endif /* _KERN_SFS_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * lockstat.h
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With "options lockstat" in the kernel config, sleep locks, rwlocks,
+ * CVs, and spinlocks that have been given a name keep statistics, added
+ * up across all locks with the same name. Collection starts out
+ * turned off (timing needs the clock device, which isn't there
+ * early in boot) and is turned on from the kernel menu.
+ *
+ * The counters are updated without any locking of their own, so
+ * with several cpus using different locks of the same name at once
+ * they can lose the odd count. That's good enough for finding out
+ * which locks are hot.
+ *
+ * Without the option, none of this is compiled in.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+#define LOCKSTAT_NAMELEN	24	/* longer names are truncated */
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];	/* lock name */
+	const char *ls_kind;		/* "spin", "lock", "rw", or "cv" */
+	uint64_t ls_acquires;		/* acquisitions (waits, for CVs) */
+	uint64_t ls_contended;		/* acquisitions that had to wait */
+	uint64_t ls_spins;		/* trips around spin loops */
+	uint64_t ls_sleepns;		/* total time asleep (ns) */
+	uint64_t ls_maxholdns;		/* longest time held (ns) */
+};
+
+/* True while statistics are being collected. */
+extern volatile bool lockstat_enabled;
+
+/*
+ * Find or create the statistics entry for NAME. Returns NULL if the
+ * table is full, in which case the lock simply isn't tracked.
+ */
+struct lockstat *lockstat_get(const char *name, const char *kind);
+
+/* Current time in nanoseconds, for timing waits and holds. */
+uint64_t lockstat_now(void);
+
+/* Record that a lock acquired at SINCE has been released. */
+void lockstat_held(struct lockstat *ls, uint64_t since);
+
+/* Control and reporting, for the kernel menu. */
+void lockstat_enable(bool on);
+void lockstat_reset(void);
+void lockstat_print(unsigned max);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pipe.h
+ */
+
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes and named pipes (FIFOs).
+ *
+ * A pipe is a page-sized ring buffer with one reader and one writer
+ * side. Each open end of a pipe is its own vnode, so that closing the
+ * last writer (or reader) end is visible to the other side: readers
+ * then see EOF, and writers get EPIPE.
+ *
+ *    pipe_create     - Create an anonymous pipe. Hands back a read end
+ *                      and a write end, both already open (release
+ *                      them with vfs_close).
+ *
+ *    pipe_mkfifo     - Create a pipe to be used as a named FIFO.
+ *
+ *    pipe_rmfifo     - Drop the reference held by the creator of the
+ *                      FIFO PP. It goes away once no longer open.
+ *
+ *    pipe_fifovnode  - Hand back a fresh, not yet open, vnode for the
+ *                      FIFO PP. Which end it becomes is decided by the
+ *                      flags passed to open; opening for read waits
+ *                      for a writer and vice versa.
+ *
+ * Named FIFOs live in the VFS device namespace; see vfs_mkfifo.
+ */
+
+struct pipe;	/* Opaque */
+struct vnode;
+
+int pipe_create(struct vnode **readend, struct vnode **writeend);
+struct pipe *pipe_mkfifo(void);
+void pipe_rmfifo(struct pipe *pp);
+int pipe_fifovnode(struct pipe *pp, struct vnode **ret);
+
+
+#endif /* _PIPE_H_ */
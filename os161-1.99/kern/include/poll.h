@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * poll.h
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Kernel support for poll() and select().
+ *
+ * Anything that can become ready (readable, writable, hung up) keeps
+ * a struct pollqueue and calls pollqueue_wakeup whenever its state
+ * changes in a way a poller might care about. This is cheap when
+ * nobody is polling.
+ *
+ * VOP_POLL (and the d_poll device hook) report the events currently
+ * true, and if given a struct pollwait, first register it on the
+ * object's pollqueue with pollwait_register. A poller thus scans
+ * once with registration, and then sleeps a single time on its
+ * pollwait until any of the registered objects calls
+ * pollqueue_wakeup or the timeout runs out; nothing is looked at
+ * while it is asleep.
+ *
+ *    pollqueue_init    - Initialize/clean up a pollqueue. It must have
+ *    pollqueue_cleanup   no pollers registered when cleaned up.
+ *    pollqueue_wakeup  - Wake up everyone polling on the queue. May be
+ *                        called from interrupt handlers.
+ *
+ *    pollwait_init     - Set up a pollwait. TIMEOUT is in milliseconds;
+ *                        negative means wait forever.
+ *    pollwait_register - Register PW on PQ. Called by VOP_POLL.
+ *    pollwait_sleep    - Sleep until woken or timed out. Returns true
+ *                        if it timed out.
+ *    pollwait_cleanup  - Deregister from everything and tear down.
+ *
+ *    poll_alwaysready  - The VOP_POLL answer for objects (files,
+ *                        disks) that never block.
+ *
+ *    poll_timerclock   - Called from timerclock() to run timeouts.
+ */
+
+#include <kern/poll.h>
+#include <spinlock.h>
+
+struct wchan;
+struct pollentry;
+
+struct pollqueue {
+	struct spinlock pq_lock;
+	struct pollentry *volatile pq_entries;
+};
+
+struct pollwait {
+	struct spinlock pw_lock;
+	struct wchan *pw_wchan;
+	volatile bool pw_woken;		/* something happened */
+	volatile bool pw_timedout;
+	int pw_ticks;			/* timer ticks left, or -1 */
+	struct pollwait *pw_timednext;	/* on the timeout list */
+	struct pollentry *pw_entries;	/* one per registration */
+};
+
+void pollqueue_init(struct pollqueue *pq);
+void pollqueue_cleanup(struct pollqueue *pq);
+void pollqueue_wakeup(struct pollqueue *pq);
+
+int pollwait_init(struct pollwait *pw, int timeout);
+int pollwait_register(struct pollwait *pw, struct pollqueue *pq);
+bool pollwait_sleep(struct pollwait *pw);
+void pollwait_cleanup(struct pollwait *pw);
+
+int poll_alwaysready(int events);
+
+void poll_timerclock(void);
+
+
+#endif /* _POLL_H_ */
@@ -65,7 +65,14 @@ typedef struct procdata {
 	bool p_exited;
 } procdata_t ;
 
-extern struct lock *procdata_lock;
+/*
+ * procdata_lock protects the process tree (the procdata links) and
+ * pid_use. procdata_waitlock and procdata_cv are for waiting for a
+ * child to exit; p_exited and p_exit_code are set with both locks
+ * held, so holding either is enough to read them.
+ */
+extern struct rwlock *procdata_lock;
+extern struct lock *procdata_waitlock;
 extern struct cv *procdata_cv;
 extern bool pid_use[PID_MAX + 1];
 
@@ -42,17 +42,149 @@
 #include <fs.h>
 #include <vnode.h>
 
+struct lock;
+
 /*
  * Get on-disk structures and constants that are made available to 
  * userland for the benefit of mksfs, dumpsfs, etc.
  */
 #include <kern/sfs.h>
 
+/*
+ * Loaded vnodes are kept in a hash table keyed by inode number.
+ * Vnodes whose last reference goes away but whose file still exists
+ * are not freed right away; they are parked on an LRU list (still in
+ * the hash table) so that a later lookup can pick them up again
+ * without rereading the inode. At most SFS_VCACHE_MAX are kept.
+ */
+#define SFS_VHASH_SIZE   64		/* # of buckets; power of 2 */
+#define SFS_VHASH(ino)   ((ino) & (SFS_VHASH_SIZE - 1))
+#define SFS_VCACHE_MAX   32		/* max idle vnodes kept around */
+
+/*
+ * Blocks for a file are allocated starting from a per-file goal
+ * block (just past the last block it got), so files end up laid out
+ * contiguously. When a write extends a file, up to SFS_PREALLOC
+ * further free blocks following the one allocated are reserved for
+ * the file in the in-memory freemap; they are handed out by later
+ * allocations and given back when the vnode is reclaimed or the file
+ * is truncated.
+ */
+#define SFS_PREALLOC     8		/* max blocks reserved ahead */
+
+/*
+ * Whole-block reads and writes are done straight between the disk and
+ * the caller's buffer, as many physically contiguous blocks at a time
+ * as possible, up to SFS_MAXRUN blocks per device request.
+ */
+#define SFS_MAXRUN       64		/* max blocks per transfer */
+
+/*
+ * Index of the overflow area of a hashed directory (see kern/sfs.h),
+ * kept in memory so that names not in their bucket can be found
+ * without reading the whole overflow area. It maps name hashes to
+ * directory slots and also lists the free overflow slots. It is
+ * built from disk the first time it's needed, is protected by the
+ * directory's sv_lock, and may be thrown away at any time (e.g. when
+ * out of memory) to be rebuilt later.
+ */
+struct sfs_ovent {
+	uint32_t oe_hash;		/* hash of the name (unused if free) */
+	uint32_t oe_slot;		/* directory slot */
+	struct sfs_ovent *oe_next;	/* next in chain or free list */
+};
+
+struct sfs_ovindex {
+	struct sfs_ovent **oi_table;	/* hash chains; power of 2 of them */
+	unsigned oi_size;		/* number of chains */
+	unsigned oi_count;		/* number of names */
+	struct sfs_ovent *oi_free;	/* free slots */
+};
+
+/*
+ * Small write-through cache of indirect blocks, shared by all files
+ * on the volume, so walking a file's indirect blocks doesn't have to
+ * reread them from disk on every access. An entry with ic_block 0 is
+ * unused. Entries are replaced in least-recently-used order.
+ */
+#define SFS_IDCACHE_SIZE 8
+
+struct sfs_idcache {
+	uint32_t ic_block;		/* disk block cached here, or 0 */
+	unsigned ic_stamp;		/* time of last use, for LRU */
+	uint32_t ic_data[SFS_DBPERIDB];	/* block contents */
+};
+
+/*
+ * In-memory state of the metadata journal (see kern/sfs.h for the
+ * on-disk format). Metadata block writes are copied into the table
+ * of entries as part of the running transaction instead of going to
+ * disk; reads of those blocks are satisfied from the table. A commit
+ * writes the running transaction into the log with one device
+ * request. Committed blocks stay in the table until the log fills
+ * up (or the volume is unmounted), at which point they are all
+ * written to their real locations and the log is emptied; this is
+ * the checkpoint. Each block appears in the table at most once,
+ * with its newest contents. Entries in use are hashed by block
+ * number so lookups don't have to scan the table; unused ones are
+ * kept on a free list.
+ */
+struct sfs_jentry {
+	uint32_t je_block;		/* disk block, or 0 if unused */
+	bool je_running;		/* in the running transaction */
+	bool je_logged;			/* in a committed transaction */
+	char *je_data;			/* newest contents */
+	struct sfs_jentry *je_next;	/* hash chain, or free list */
+};
+
+struct sfs_journal {
+	struct lock *j_lock;		/* lock for everything here */
+	uint32_t j_start;		/* first block (the header) */
+	uint32_t j_size;		/* size in blocks */
+	uint32_t j_seq;			/* number of running transaction */
+	uint32_t j_next;		/* next free log block (from j_start) */
+	unsigned j_nrunning;		/* # entries in running transaction */
+	unsigned j_nentries;		/* # entries in use */
+	struct sfs_jentry *j_entries;	/* table of j_size entries */
+	struct sfs_jentry **j_hash;	/* hash chains of entries in use */
+	uint32_t j_hashmask;		/* # of chains, minus one */
+	struct sfs_jentry *j_free;	/* unused entries */
+	char *j_iobuf;			/* SFS_JMAXTX+2 blocks for commits */
+};
+
+/*
+ * Locking. Each vnode has sv_lock, which protects its inode and
+ * contents. Each filesystem has sfs_vnlock for the table of loaded
+ * vnodes (hash table, LRU list, and counts), sfs_idlock for the
+ * indirect block cache, sfs_freemaplock for the freemap and
+ * superblock, and the journal's j_lock. The order is:
+ *
+ *     directory sv_lock
+ *     file sv_lock
+ *     sfs_vnlock
+ *     sfs_idlock
+ *     sfs_freemaplock
+ *     j_lock
+ *
+ * (Since there are no subdirectories, the only directory is the
+ * root.) sfs_reclaim holds sfs_vnlock while working on a vnode
+ * nobody else has a reference to, so it doesn't need sv_lock.
+ */
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
+	struct lock *sv_lock;           /* lock for sv_i and file contents */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_vnode *sv_hashnext;  /* next vnode in hash chain */
+	bool sv_idle;                   /* true if on the LRU list */
+	struct sfs_vnode *sv_lruprev;   /* LRU list links (if sv_idle) */
+	struct sfs_vnode *sv_lrunext;
+	uint32_t sv_goal;               /* where to look for the next block */
+	uint32_t sv_pastart;            /* first preallocated block */
+	unsigned sv_palen;              /* # of preallocated blocks left */
+	struct sfs_ovindex *sv_ovindex; /* hashed dir overflow index or NULL */
 };
 
 struct sfs_fs {
@@ -60,9 +192,21 @@ struct sfs_fs {
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* lock for the vnode table */
+	struct sfs_vnode *sfs_vhash[SFS_VHASH_SIZE]; /* loaded vnodes */
+	unsigned sfs_nvnodes;           /* # of vnodes in sfs_vhash */
+	struct sfs_vnode *sfs_lruhead;  /* least recently used idle vnode */
+	struct sfs_vnode *sfs_lrutail;  /* most recently used idle vnode */
+	unsigned sfs_nidle;             /* # of vnodes on the LRU list */
+	struct lock *sfs_freemaplock;   /* lock for freemap and superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_freemapdirtyblocks; /* which freemap blocks */
+	struct bitmap *sfs_pamap;       /* preallocated (memory only) */
+	struct lock *sfs_idlock;        /* lock for sfs_idcache */
+	struct sfs_idcache sfs_idcache[SFS_IDCACHE_SIZE]; /* indirect blks */
+	unsigned sfs_idclock;           /* LRU clock for sfs_idcache */
+	struct sfs_journal *sfs_journal; /* metadata journal, or NULL */
 };
 
 /*
@@ -84,8 +228,23 @@ int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+/* Metadata journal (sfs_journal.c) */
+int sfs_jmount(struct sfs_fs *sfs);
+void sfs_jdestroy(struct sfs_fs *sfs);
+int sfs_jwblock(struct sfs_fs *sfs, void *data, uint32_t block);
+bool sfs_jrblock(struct sfs_fs *sfs, void *data, uint32_t block);
+int sfs_jrevoke(struct sfs_fs *sfs, uint32_t block);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jcheckpoint(struct sfs_fs *sfs);
+
+/* Write a vnode's inode out (to the journal) without committing */
+int sfs_syncvnode(struct sfs_vnode *sv);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
+/* Drop idle cached vnodes (all of them if MAX is 0) */
+int sfs_vcache_trim(struct sfs_fs *sfs, unsigned max);
+
 
 #endif /* _SFS_H_ */
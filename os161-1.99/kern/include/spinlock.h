@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -56,18 +57,42 @@
  */
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+	volatile spinlock_data_t lk_nextticket;	/* Ticket locks only. */
+	bool lk_isticket;		/* True for a ticket lock. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	const char *lk_name;		/* Name for statistics, or NULL. */
+	struct lockstat *lk_stat;	/* Statistics, once looked up. */
+	uint64_t lk_acqtime;		/* When acquired, if timing. */
+#endif
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
+ * Ticket locks get a name, which is used for lock statistics.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, false, NULL, \
+	  NULL, NULL, 0 }
+#define SPINLOCK_TICKET_INITIALIZER(name) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, true, NULL, \
+	  name, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, false, NULL }
+#define SPINLOCK_TICKET_INITIALIZER(name) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, true, NULL }
+#endif
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Initialize a spinlock as a ticket lock. Waiting cpus
+ *		get a ticket lock in the order they asked for it; use
+ *		this for heavily contended locks so no cpu starves.
+ *		NAME (a string constant) is used for lock statistics.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +102,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk, const char *name);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
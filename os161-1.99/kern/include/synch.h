@@ -48,6 +48,7 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+	unsigned sem_nwaiters;		/* threads asleep in P */
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -76,8 +77,14 @@ struct lock {
         char *lk_name;
         struct spinlock lk_spnlk;
 	struct thread *lk_hldr;
+	struct cpu *lk_hldrcpu;		/* cpu lk_hldr took the lock on */
 	struct wchan *lk_wchn;
+	unsigned lk_nwaiters;		/* threads asleep on lk_wchn */
 	volatile int lk_volatile;
+#if OPT_LOCKSTAT
+	struct lockstat *lk_stat;	/* statistics, once looked up */
+	uint64_t lk_acqtime;		/* when acquired, if timing */
+#endif
         // (don't forget to mark things volatile as needed)
 };
 
@@ -117,6 +124,10 @@ void lock_destroy(struct lock *);
 struct cv {
         char *cv_name;
         struct wchan *cv_wchn;
+	unsigned cv_nwaiters;		/* protected by the associated lock */
+#if OPT_LOCKSTAT
+	struct lockstat *cv_stat;	/* statistics, once looked up */
+#endif
         // (don't forget to mark things volatile as needed)
 };
 
@@ -141,5 +152,54 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too, so a stream of readers can't starve it out. When a writer
+ * releases, readers that were waiting get the lock ahead of the next
+ * writer, so readers can't be starved either.
+ *
+ * Because of the writer preference a thread must not take the read
+ * lock recursively; if a writer arrived in between it would deadlock.
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rwlk_name;
+	struct spinlock rwlk_spnlk;
+	struct wchan *rwlk_rwchn;	/* waiting readers sleep here */
+	struct wchan *rwlk_wwchn;	/* waiting writers sleep here */
+	unsigned rwlk_readers;		/* readers holding the lock */
+	bool rwlk_writing;		/* true if a writer holds the lock */
+	struct thread *rwlk_writer;	/* the writer, if any */
+	unsigned rwlk_rwaiting;		/* readers asleep */
+	unsigned rwlk_wwaiting;		/* writers asleep */
+#if OPT_LOCKSTAT
+	struct lockstat *rwlk_stat;	/* statistics, once looked up */
+	uint64_t rwlk_acqtime;		/* when write-acquired, if timing */
+#endif
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading (shared).
+ *    rwlock_release_read  - Release a read hold.
+ *    rwlock_acquire_write - Get the lock for writing (exclusive).
+ *    rwlock_release_write - Release a write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing. (Read holds aren't tracked
+ *                   per-thread, so there's no equivalent for them.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
 
@@ -63,9 +63,15 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_readv(int fdesc, userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fdesc, userptr_t iov, int iovcnt, int *retval);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
+int sys_select(int nfds, userptr_t readfds, userptr_t writefds,
+	       userptr_t exceptfds, userptr_t timeout, int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
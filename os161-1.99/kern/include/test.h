@@ -61,6 +61,7 @@ int queuetest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int affinitytest(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
@@ -79,6 +80,8 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int createstress(int, char **);
 int printfile(int, char **);
+int pipetest(int, char **);
+int emufstest(int, char **);
 
 /* other tests */
 int malloctest(int, char **);
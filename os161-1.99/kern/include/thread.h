@@ -83,6 +83,13 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_schedlevel;		/* Scheduling priority level */
+	unsigned t_schedticks;		/* Ticks used at current level */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastrun;		/* t_lastcpu's hardclocks at the time */
+	struct cpu *t_affinity;		/* Preferred CPU (a hint), or NULL */
+	uint32_t t_deadline;		/* Timer tick to wake at (clocknap) */
+	struct thread *t_timernext;	/* Next in timer wheel slot */
 
 	/*
 	 * Interrupt state fields.
@@ -158,7 +165,32 @@ void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Check if thread T is currently running on cpu C. The answer may be
+ * stale as soon as it's returned, so it's only good as a hint (e.g.
+ * whether to spin or sleep waiting for T). T is not dereferenced, so
+ * it may be a thread that has since exited.
+ */
+bool thread_isrunning_on(struct cpu *c, struct thread *t);
+
+/*
+ * Set the current thread's CPU affinity hint, or clear it with NULL.
+ * If the thread is on another CPU, it moves there before this
+ * returns (by napping for a tick; see thread.c). Threads forked
+ * afterwards inherit the hint. New threads are placed on that CPU
+ * unless it is clearly busier than the others, threads that wake up
+ * are sent back to it, and stealing and migration leave threads on
+ * the CPU they prefer. Nothing pins a thread, though; it's only a
+ * preference, and it can be changed or cleared at any time.
+ */
+void thread_setaffinity(struct cpu *c);
+
+/*
+ * Return the cpu numbered NUM, or NULL if there isn't one.
+ */
+struct cpu *thread_getcpu(unsigned num);
+
+/*
+ * Adjust scheduling priorities. Called from the timer interrupt.
  */
 void schedule(void);
 
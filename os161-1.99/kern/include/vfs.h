@@ -147,6 +147,10 @@ int vfs_getcwd(struct uio *buf);
  *                    gizmos like Linux procfs or BSD kernfs, not for
  *                    mounting filesystems on disk devices.
  *
+ *    vfs_mkfifo    - Create a named pipe, accessible as "NAME:". Each
+ *                    open of it is a reader or a writer, according to
+ *                    the open flags.
+ *
  *    vfs_mount     - Attempt to mount a filesystem on a device. The
  *                    device named by DEVNAME will be looked up and 
  *                    passed, along with DATA, to the supplied function
@@ -166,6 +170,7 @@ void vfs_clearbootfs(void);
 
 int vfs_adddev(const char *devname, struct device *dev, int mountable);
 int vfs_addfs(const char *devname, struct fs *fs);
+int vfs_mkfifo(const char *name);
 
 int vfs_mount(const char *devname, void *data, 
 	      int (*mountfunc)(void *data,
@@ -174,6 +179,36 @@ int vfs_mount(const char *devname, void *data,
 int vfs_unmount(const char *devname);
 int vfs_unmountall(void);
 
+/*
+ * Name cache, for filesystems that want one.
+ *
+ *    vfs_ncache_bootstrap - Called from vfs_bootstrap.
+ *
+ *    vfs_ncache_lookup   - Look up NAME in directory DIR. Returns false
+ *                          on a cache miss. On a hit, returns true and
+ *                          hands back the vnode with its refcount
+ *                          incremented, or NULL if NAME is known not
+ *                          to exist.
+ *
+ *    vfs_ncache_enter    - Record that NAME in DIR is VN, or that NAME
+ *                          does not exist if VN is NULL.
+ *
+ *    vfs_ncache_remove   - Forget NAME in DIR. Filesystems using the
+ *                          cache must call this whenever they create
+ *                          or remove a directory entry.
+ *
+ *    vfs_ncache_purgefs  - Forget everything about filesystem FS.
+ *                          Called by vfs_unmount.
+ *
+ * The cache has its own lock; none of these need the vfs big lock.
+ */
+void vfs_ncache_bootstrap(void);
+bool vfs_ncache_lookup(struct vnode *dir, const char *name,
+		       struct vnode **result);
+void vfs_ncache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_ncache_remove(struct vnode *dir, const char *name);
+void vfs_ncache_purgefs(struct fs *fs);
+
 /*
  * Array of vnodes.
  */
@@ -185,8 +220,11 @@ DECLARRAY(vnode);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * Global lock for the VFS device/mount table, the boot filesystem,
+ * and mount/unmount/sync. Filesystems do their own locking for
+ * everything else (SFS has per-vnode and per-filesystem locks;
+ * emufs still serializes itself on this lock). Vnode counts are
+ * protected by the vnode's vn_countlock.
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
@@ -30,9 +30,11 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <spinlock.h>
 
 struct uio;
 struct stat;
+struct pollwait;
 
 /*
  * A struct vnode is an abstract representation of a file.
@@ -50,10 +52,14 @@ struct stat;
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
+ *
+ * vn_countlock protects vn_refcount and vn_opencount. Nothing else
+ * in the vnode is protected by it; the filesystem locks its own data.
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	int vn_opencount;
+	struct spinlock vn_countlock;   /* Lock for the two counts */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -120,6 +126,11 @@ struct vnode {
  *                      DATA. The interpretation of the data is specific
  *                      to each ioctl.
  *
+ *    vop_poll        - Return in *REVENTS which of the poll EVENTS
+ *                      (see kern/poll.h) are currently true. If PW is
+ *                      not NULL, first register it (see poll.h) so the
+ *                      poller is woken up when that may have changed.
+ *
  *    vop_stat        - Return info about a file. The pointer is a 
  *                      pointer to struct stat; see kern/stat.h.
  *
@@ -205,6 +216,8 @@ struct vnode_ops {
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollwait *pw, int *revents);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	int (*vop_tryseek)(struct vnode *object, off_t pos);
@@ -250,6 +263,7 @@ struct vnode_ops {
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
+#define VOP_POLL(vn, ev, pw, rev)       (__VOP(vn, poll)(vn, ev, pw, rev))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
@@ -81,5 +81,20 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Like wchan_wakeone, but return the thread that was woken, or NULL
+ * if nobody was sleeping. This is for handing something directly to
+ * the woken thread. The pointer is only good for identifying the
+ * thread; it may already be running, so don't dereference it.
+ */
+struct thread *wchan_wakeone_thread(struct wchan *wc);
+
+/*
+ * Wake up the thread T, which must be sleeping on the channel (or be
+ * about to, with the channel locked). For callers that keep their
+ * own record of who is asleep, like the timer wheel.
+ */
+void wchan_wakethread(struct wchan *wc, struct thread *t);
+
 
 #endif /* _WCHAN_H_ */
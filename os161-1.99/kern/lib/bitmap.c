@@ -47,9 +47,28 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * To avoid scanning the whole bitmap on every allocation, there is
+ * also a summary level kept in memory only: one bit per word of the
+ * bitmap, set if that word is known to be full. Summary words are
+ * uint32_t since they never go to disk. A summary bit may be clear
+ * for a word that is actually full (if the data was written through
+ * bitmap_getdata); the scan fixes that up when it finds it. A set
+ * summary bit is always right, so callers writing the data directly
+ * may only set bits, never clear them.
+ *
+ * bitmap_alloc also remembers the word it last allocated from and
+ * starts there next time (next fit).
+ */
+#define SUMMARY_BITS    32
+#define SUMMARY_ALLBITS (0xffffffffU)
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned nwords;        /* number of words in v */
+        uint32_t *full;         /* summary: bit set if word is full */
+        unsigned hint;          /* word to start bitmap_alloc from */
 };
 
 
@@ -57,9 +76,10 @@ struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b; 
-        unsigned words;
+        unsigned words, swords;
 
         words = DIVROUNDUP(nbits, BITS_PER_WORD);
+        swords = DIVROUNDUP(words, SUMMARY_BITS);
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
@@ -69,9 +89,18 @@ bitmap_create(unsigned nbits)
                 kfree(b);
                 return NULL;
         }
+        b->full = kmalloc(swords*sizeof(uint32_t));
+        if (b->full == NULL) {
+                kfree(b->v);
+                kfree(b);
+                return NULL;
+        }
 
         bzero(b->v, words*sizeof(WORD_TYPE));
+        bzero(b->full, swords*sizeof(uint32_t));
         b->nbits = nbits;
+        b->nwords = words;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -86,6 +115,11 @@ bitmap_create(unsigned nbits)
                 }
         }
 
+        /* Summary bits past the last word count as full */
+        if (words % SUMMARY_BITS != 0) {
+                b->full[swords-1] = SUMMARY_ALLBITS << (words % SUMMARY_BITS);
+        }
+
         return b;
 }
 
@@ -95,29 +129,166 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+/*
+ * Index of the lowest clear bit in X, which must not be all ones.
+ */
+static
+unsigned
+bitmap_ffz(uint32_t x)
+{
+        unsigned n = 0;
+
+        KASSERT(x != SUMMARY_ALLBITS);
+        x = ~x;
+        if ((x & 0xffff) == 0) {
+                n += 16;
+                x >>= 16;
+        }
+        if ((x & 0xff) == 0) {
+                n += 8;
+                x >>= 8;
+        }
+        if ((x & 0xf) == 0) {
+                n += 4;
+                x >>= 4;
+        }
+        if ((x & 0x3) == 0) {
+                n += 2;
+                x >>= 2;
+        }
+        if ((x & 0x1) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+/*
+ * Update the summary bit for word IX.
+ */
+static
+inline
+void
+bitmap_summarize(struct bitmap *b, unsigned ix)
+{
+        uint32_t smask = (uint32_t)1 << (ix % SUMMARY_BITS);
+
+        if (b->v[ix] == WORD_ALLBITS) {
+                b->full[ix / SUMMARY_BITS] |= smask;
+        }
+        else {
+                b->full[ix / SUMMARY_BITS] &= ~smask;
+        }
+}
+
+/*
+ * Find a word that isn't full, looking at words START up to (but not
+ * including) END. Whole summary words of full words are skipped at
+ * once. Returns END if there isn't one.
+ */
+static
+unsigned
+bitmap_findword(struct bitmap *b, unsigned start, unsigned end)
+{
+        unsigned ix, sw, shift;
+        uint32_t sum;
+
+        ix = start;
+        while (ix < end) {
+                sw = ix / SUMMARY_BITS;
+                shift = ix % SUMMARY_BITS;
+
+                /* Treat the words before IX in this summary word as full */
+                sum = b->full[sw] | ~(SUMMARY_ALLBITS << shift);
+                if (sum == SUMMARY_ALLBITS) {
+                        ix = (sw + 1) * SUMMARY_BITS;
+                        continue;
+                }
+
+                ix = sw * SUMMARY_BITS + bitmap_ffz(sum);
+                if (ix >= end) {
+                        break;
+                }
+                if (b->v[ix] != WORD_ALLBITS) {
+                        return ix;
+                }
+
+                /* Stale summary; the data was loaded from outside */
+                bitmap_summarize(b, ix);
+                ix++;
+        }
+        return end;
+}
+
+/*
+ * Allocate the lowest clear bit in word IX, which must not be full.
+ */
+static
+unsigned
+bitmap_takebit(struct bitmap *b, unsigned ix)
+{
+        unsigned offset;
+
+        KASSERT(b->v[ix] != WORD_ALLBITS);
+        offset = bitmap_ffz(b->v[ix] | ~(uint32_t)WORD_ALLBITS);
+        b->v[ix] |= ((WORD_TYPE)1) << offset;
+        bitmap_summarize(b, ix);
+        return ix*BITS_PER_WORD + offset;
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
         unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        /* Next fit: start where the last allocation left off */
+        ix = bitmap_findword(b, b->hint, b->nwords);
+        if (ix == b->nwords) {
+                ix = bitmap_findword(b, 0, b->hint);
+                if (ix == b->hint) {
+                        return ENOSPC;
                 }
         }
-        return ENOSPC;
+
+        b->hint = ix;
+        *index = bitmap_takebit(b, ix);
+        KASSERT(*index < b->nbits);
+        return 0;
+}
+
+int
+bitmap_alloc_near(struct bitmap *b, unsigned goal, unsigned *index)
+{
+        unsigned gix, ix;
+        WORD_TYPE avail;
+
+        if (goal >= b->nbits) {
+                goal = 0;
+        }
+        gix = goal / BITS_PER_WORD;
+
+        /* First try the goal bit and the ones after it in its word */
+        avail = ~b->v[gix] & (WORD_TYPE)(WORD_ALLBITS << (goal % BITS_PER_WORD));
+        if (avail != 0) {
+                *index = gix*BITS_PER_WORD +
+                        bitmap_ffz(~(uint32_t)avail);
+                b->v[gix] |= ((WORD_TYPE)1) << (*index % BITS_PER_WORD);
+                bitmap_summarize(b, gix);
+                KASSERT(*index < b->nbits);
+                return 0;
+        }
+
+        /* Then the following words, wrapping around */
+        ix = bitmap_findword(b, gix+1, b->nwords);
+        if (ix == b->nwords) {
+                ix = bitmap_findword(b, 0, gix+1);
+                if (ix == gix+1) {
+                        return ENOSPC;
+                }
+        }
+
+        *index = bitmap_takebit(b, ix);
+        KASSERT(*index < b->nbits);
+        return 0;
 }
 
 static
@@ -142,6 +313,7 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        bitmap_summarize(b, ix);
 }
 
 void
@@ -155,6 +327,7 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        bitmap_summarize(b, ix);
 }
 
 
@@ -171,6 +344,7 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        kfree(b->full);
         kfree(b->v);
         kfree(b);
 }
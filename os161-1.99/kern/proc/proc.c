@@ -60,7 +60,8 @@
 
 #if OPT_A2
 
-struct lock *procdata_lock;
+struct rwlock *procdata_lock;
+struct lock *procdata_waitlock;
 struct cv *procdata_cv;
 
 #endif // Optional for ASSGN2
@@ -346,7 +347,8 @@ proc_bootstrap(void)
 
 #if OPT_A2
 
-	procdata_lock = lock_create("procdata_lock");
+	procdata_lock = rwlock_create("procdata_lock");
+	procdata_waitlock = lock_create("procdata_waitlock");
 	procdata_cv = cv_create("procdata_cv");
 	
 	for (int ii = 1; ii <= PID_MAX; ii++)
@@ -391,17 +393,17 @@ proc_create_runprogram(const char *name)
 
 #if OPT_A2
 
-	lock_acquire(procdata_lock);
+	rwlock_acquire_write(procdata_lock);
 	int pid = procdata_find_free_pid(NULL);
 	
 	if (pid < 0)
 	{
-		lock_release(procdata_lock);
+		rwlock_release_write(procdata_lock);
 		return NULL;
 	}
 
 	pid_use[pid] = true;
-	lock_release(procdata_lock);
+	rwlock_release_write(procdata_lock);
 
 	struct proc *proc = proc_create_runprogram2(name);
 	
@@ -42,7 +42,9 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
 #include "opt-synchprobs.h"
+#include "opt-lockstat.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 
@@ -391,6 +393,30 @@ cmd_unmount(int nargs, char **args)
 	return vfs_unmount(device);
 }
 
+/*
+ * Command for creating a named pipe, accessed as "name:".
+ */
+static
+int
+cmd_mkfifo(int nargs, char **args)
+{
+	char *name;
+
+	if (nargs != 2) {
+		kprintf("Usage: mkfifo name\n");
+		return EINVAL;
+	}
+
+	name = args[1];
+
+	/* Allow (but do not require) colon after the name */
+	if (name[strlen(name)-1]==':') {
+		name[strlen(name)-1] = 0;
+	}
+
+	return vfs_mkfifo(name);
+}
+
 /*
  * Command to set the "boot fs". 
  *
@@ -432,6 +458,44 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_LOCKSTAT
+/*
+ * Command for lock statistics: turn collection on or off, clear the
+ * counters, or print the N most contended locks (default 10).
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [on|off|reset|N]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 1) {
+		lockstat_print(10);
+	}
+	else if (!strcmp(args[1], "on")) {
+		lockstat_enable(true);
+	}
+	else if (!strcmp(args[1], "off")) {
+		lockstat_enable(false);
+	}
+	else if (!strcmp(args[1], "reset")) {
+		lockstat_reset();
+	}
+	else if (atoi(args[1]) > 0) {
+		lockstat_print(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: lockstat [on|off|reset|N]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -467,6 +531,7 @@ static const char *opsmenu[] = {
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
+	"[mkfifo]  Create a named pipe       ",
 	"[pf]      Print a file              ",
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
@@ -496,6 +561,7 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[aff] CPU affinity test             ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -511,6 +577,8 @@ static const char *testmenu[] = {
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+	"[pt]  Pipe test                     ",
+	"[emu] emufs cache test              ",
 	NULL
 };
 
@@ -542,6 +610,9 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -578,6 +649,7 @@ static struct {
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
+	{ "mkfifo",	cmd_mkfifo },
 	{ "pf",		printfile },
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
@@ -599,6 +671,9 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -611,6 +686,7 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "aff",	affinitytest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
@@ -627,6 +703,8 @@ static struct {
 	{ "fs3",	writestress },
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
+	{ "pt",		pipetest },
+	{ "emu",	emufstest },
 
 	{ NULL, NULL }
 };
@@ -1,13 +1,17 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
+#include <kern/time.h>
 #include <lib.h>
+#include <limits.h>
 #include <uio.h>
+#include <copyinout.h>
 #include <syscall.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <poll.h>
 
 /* handler for write() system call                  */
 /*
@@ -58,3 +62,373 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+
+/*
+ * Common code for readv/writev: do one VOP_READ or VOP_WRITE
+ * covering all NIOV buffers in KIOV (whose base pointers are user
+ * pointers).
+ *
+ * As with write() above, only the console descriptors exist so far:
+ * stdin for reading, and stdout and stderr for writing. Without a
+ * file table there is no seekable object to do positional I/O on,
+ * so pread/pwrite are left unimplemented until there is one.
+ */
+static
+int
+file_rw(int fdesc, struct iovec *kiov, int niov, enum uio_rw rw,
+        int *retval)
+{
+  struct vnode *vn;
+  struct uio u;
+  size_t total;
+  int i, res;
+
+  if (rw == UIO_READ) {
+    if (fdesc != STDIN_FILENO) {
+      return EUNIMP;
+    }
+  }
+  else if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
+    return EUNIMP;
+  }
+  KASSERT(curproc != NULL);
+  KASSERT(curproc->console != NULL);
+  KASSERT(curproc->p_addrspace != NULL);
+  vn = curproc->console;
+
+  /* the total must fit in the (signed) return value */
+  total = 0;
+  for (i=0; i<niov; i++) {
+    if (kiov[i].iov_len > (size_t)0x7fffffff - total) {
+      return EINVAL;
+    }
+    total += kiov[i].iov_len;
+  }
+
+  u.uio_iov = kiov;
+  u.uio_iovcnt = niov;
+  u.uio_offset = 0;  /* not needed for the console */
+  u.uio_resid = total;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = rw;
+  u.uio_space = curproc->p_addrspace;
+
+  if (rw == UIO_READ) {
+    res = VOP_READ(vn, &u);
+  }
+  else {
+    res = VOP_WRITE(vn, &u);
+  }
+  if (res) {
+    return res;
+  }
+
+  /* pass back the number of bytes actually transferred */
+  *retval = total - u.uio_resid;
+  KASSERT(*retval >= 0);
+  return 0;
+}
+
+/*
+ * Common code for readv() and writev(): copy in the user's iovec
+ * array in one go and hand it to file_rw.
+ */
+static
+int
+file_rwv(int fdesc, userptr_t uiov, int iovcnt, enum uio_rw rw,
+         int *retval)
+{
+  struct iovec *kiov;
+  int res;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
+  }
+
+  kiov = kmalloc(iovcnt * sizeof(struct iovec));
+  if (kiov == NULL) {
+    return ENOMEM;
+  }
+
+  res = copyin(uiov, kiov, iovcnt * sizeof(struct iovec));
+  if (res == 0) {
+    res = file_rw(fdesc, kiov, iovcnt, rw, retval);
+  }
+
+  kfree(kiov);
+  return res;
+}
+
+/* handler for readv() system call */
+int
+sys_readv(int fdesc, userptr_t iov, int iovcnt, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: readv(%d,%x,%d)\n",fdesc,(unsigned int)iov,iovcnt);
+  return file_rwv(fdesc, iov, iovcnt, UIO_READ, retval);
+}
+
+/* handler for writev() system call */
+int
+sys_writev(int fdesc, userptr_t iov, int iovcnt, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: writev(%d,%x,%d)\n",fdesc,(unsigned int)iov,iovcnt);
+  return file_rwv(fdesc, iov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * Map a file handle to the vnode to poll. Only the console
+ * descriptors exist so far; anything else is not open.
+ */
+static
+struct vnode *
+file_pollvnode(int fdesc)
+{
+  if (fdesc == STDIN_FILENO || fdesc == STDOUT_FILENO ||
+      fdesc == STDERR_FILENO) {
+    KASSERT(curproc != NULL);
+    KASSERT(curproc->console != NULL);
+    return curproc->console;
+  }
+  return NULL;
+}
+
+/*
+ * Check each of the NFDS entries of PFDS once, setting revents, and
+ * return the number that have something to report in *COUNT. If PW
+ * is not NULL, it gets registered with each object along the way.
+ */
+static
+int
+file_pollscan(struct pollfd *pfds, unsigned nfds, struct pollwait *pw,
+              int *count)
+{
+  struct vnode *vn;
+  unsigned i;
+  int revents, res;
+
+  *count = 0;
+  for (i=0; i<nfds; i++) {
+    pfds[i].revents = 0;
+    if (pfds[i].fd < 0) {
+      continue;
+    }
+    vn = file_pollvnode(pfds[i].fd);
+    if (vn == NULL) {
+      pfds[i].revents = POLLNVAL;
+      (*count)++;
+      continue;
+    }
+    res = VOP_POLL(vn, pfds[i].events, pw, &revents);
+    if (res) {
+      return res;
+    }
+    pfds[i].revents = revents & (pfds[i].events | POLLERR | POLLHUP);
+    if (pfds[i].revents != 0) {
+      (*count)++;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Common code for poll() and select(). The first scan registers with
+ * every object; after that we sleep once, until one of them reports
+ * a change or the timeout (milliseconds, negative for none) expires,
+ * and rescan. Nothing is polled while asleep.
+ */
+static
+int
+file_poll(struct pollfd *pfds, unsigned nfds, int timeout, int *count)
+{
+  struct pollwait pw;
+  bool timedout = false;
+  int res;
+
+  res = pollwait_init(&pw, timeout);
+  if (res) {
+    return res;
+  }
+
+  res = file_pollscan(pfds, nfds, &pw, count);
+  while (res == 0 && *count == 0 && timeout != 0 && !timedout) {
+    timedout = pollwait_sleep(&pw);
+    res = file_pollscan(pfds, nfds, NULL, count);
+  }
+
+  pollwait_cleanup(&pw);
+  return res;
+}
+
+/* handler for poll() system call */
+int
+sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+  struct pollfd *pfds = NULL;
+  int count, res;
+
+  DEBUG(DB_SYSCALL,"Syscall: poll(%x,%u,%d)\n",(unsigned int)ufds,nfds,timeout);
+
+  if (nfds > OPEN_MAX) {
+    return EINVAL;
+  }
+  if (nfds > 0) {
+    pfds = kmalloc(nfds * sizeof(struct pollfd));
+    if (pfds == NULL) {
+      return ENOMEM;
+    }
+    res = copyin(ufds, pfds, nfds * sizeof(struct pollfd));
+    if (res) {
+      kfree(pfds);
+      return res;
+    }
+  }
+
+  res = file_poll(pfds, nfds, timeout, &count);
+  if (res == 0 && nfds > 0) {
+    res = copyout(pfds, ufds, nfds * sizeof(struct pollfd));
+  }
+  if (pfds != NULL) {
+    kfree(pfds);
+  }
+  if (res) {
+    return res;
+  }
+
+  *retval = count;
+  return 0;
+}
+
+#define FDSET_ISSET(fd, set) \
+  (((set)->__fds_bits[(fd) / __NFDBITS] >> ((fd) % __NFDBITS)) & 1)
+#define FDSET_SET(fd, set) \
+  ((set)->__fds_bits[(fd) / __NFDBITS] |= (__u32)1 << ((fd) % __NFDBITS))
+
+/*
+ * handler for select() system call
+ *
+ * This turns the descriptor sets into a pollfd array and uses the
+ * poll code. Only the first NFDS bits of each set are copied in and
+ * out, as is customary.
+ */
+int
+sys_select(int nfds, userptr_t ureadfds, userptr_t uwritefds,
+           userptr_t uexceptfds, userptr_t utimeout, int *retval)
+{
+  struct __fd_set sets[3], results[3];
+  userptr_t usets[3];
+  struct timeval tv;
+  struct pollfd *pfds;
+  size_t setbytes;
+  unsigned npfds, i, j;
+  int fd, timeout, count, res;
+
+  DEBUG(DB_SYSCALL,"Syscall: select(%d,...)\n",nfds);
+
+  if (nfds < 0 || nfds > __FD_SETSIZE) {
+    return EINVAL;
+  }
+  setbytes = ((nfds + __NFDBITS - 1) / __NFDBITS) * sizeof(__u32);
+
+  usets[0] = ureadfds;
+  usets[1] = uwritefds;
+  usets[2] = uexceptfds;
+  for (i=0; i<3; i++) {
+    bzero(&sets[i], sizeof(sets[i]));
+    bzero(&results[i], sizeof(results[i]));
+    if (usets[i] != NULL && setbytes > 0) {
+      res = copyin(usets[i], &sets[i], setbytes);
+      if (res) {
+        return res;
+      }
+    }
+  }
+
+  timeout = -1;
+  if (utimeout != NULL) {
+    res = copyin(utimeout, &tv, sizeof(tv));
+    if (res) {
+      return res;
+    }
+    if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000) {
+      return EINVAL;
+    }
+    if (tv.tv_sec >= 0x7fffffff / 1000 - 1) {
+      /* effectively forever */
+      timeout = 0x7fffffff;
+    }
+    else {
+      timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+    }
+  }
+
+  pfds = NULL;
+  if (nfds > 0) {
+    pfds = kmalloc(nfds * sizeof(struct pollfd));
+    if (pfds == NULL) {
+      return ENOMEM;
+    }
+  }
+  npfds = 0;
+  for (fd=0; fd<nfds; fd++) {
+    short events = 0;
+
+    if (FDSET_ISSET(fd, &sets[0])) {
+      events |= POLLIN;
+    }
+    if (FDSET_ISSET(fd, &sets[1])) {
+      events |= POLLOUT;
+    }
+    if (FDSET_ISSET(fd, &sets[2])) {
+      events |= POLLPRI;
+    }
+    if (events != 0) {
+      pfds[npfds].fd = fd;
+      pfds[npfds].events = events;
+      npfds++;
+    }
+  }
+
+  res = file_poll(pfds, npfds, timeout, &count);
+  if (res) {
+    goto out;
+  }
+
+  count = 0;
+  for (j=0; j<npfds; j++) {
+    short rev = pfds[j].revents;
+
+    fd = pfds[j].fd;
+    if (rev & POLLNVAL) {
+      res = EBADF;
+      goto out;
+    }
+    if ((pfds[j].events & POLLIN) && (rev & (POLLIN|POLLHUP|POLLERR))) {
+      FDSET_SET(fd, &results[0]);
+      count++;
+    }
+    if ((pfds[j].events & POLLOUT) && (rev & (POLLOUT|POLLERR))) {
+      FDSET_SET(fd, &results[1]);
+      count++;
+    }
+    if ((pfds[j].events & POLLPRI) && (rev & POLLPRI)) {
+      FDSET_SET(fd, &results[2]);
+      count++;
+    }
+  }
+
+  for (i=0; i<3; i++) {
+    if (usets[i] != NULL && setbytes > 0) {
+      res = copyout(&results[i], usets[i], setbytes);
+      if (res) {
+        goto out;
+      }
+    }
+  }
+  *retval = count;
+
+ out:
+  if (pfds != NULL) {
+    kfree(pfds);
+  }
+  return res;
+}
@@ -52,7 +52,7 @@ void sys__exit(int exitcode) {
 	DEBUG(DB_PROCSYS, "Syscall: _exit (Code %d)\n",exitcode);
 	KASSERT(curproc->p_data != NULL);
 
-	lock_acquire(procdata_lock);
+	rwlock_acquire_write(procdata_lock);
 
 	procdata_t *p_data = curproc->p_data;
 
@@ -90,8 +90,10 @@ void sys__exit(int exitcode) {
 		p_data->p_exit_code = _MKWAIT_EXIT(exitcode);
 #endif // Optional for ASSGN3
 
+		lock_acquire(procdata_waitlock);
 		p_data->p_exited = true;
-		cv_broadcast(procdata_cv, procdata_lock);
+		cv_broadcast(procdata_cv, procdata_waitlock);
+		lock_release(procdata_waitlock);
 	}
 
 	else
@@ -100,7 +102,7 @@ void sys__exit(int exitcode) {
 		curproc->p_data = NULL;
 	}
 
-	lock_release(procdata_lock);
+	rwlock_release_write(procdata_lock);
 #endif // Optional for ASSGN2
 
 	/* detach this thread from its process */
@@ -137,10 +139,9 @@ sys_getpid(pid_t *retval)
 
 	DEBUG(DB_PROCSYS, "Syscall: getpid\n");
 	KASSERT(curproc->p_data != NULL);
-	lock_acquire(procdata_lock);
+	/* Our own pid never changes, so no lock is needed */
 	DEBUG(DB_PROCSYS, "PID: %d\n", curproc->p_data->p_pid);
 	*retval = curproc->p_data->p_pid;
-	lock_release(procdata_lock);
 #else
 
 	/* for now, this is just a stub that always returns a PID of 1 */
@@ -176,7 +177,7 @@ sys_waitpid(pid_t pid,
 		return ESRCH;
 	}
 
-	lock_acquire(procdata_lock);
+	rwlock_acquire_read(procdata_lock);
 
 	procdata_t *child = curproc->p_data->p_firstchild;
 
@@ -194,26 +195,34 @@ sys_waitpid(pid_t pid,
 	{
 		if (pid_use[pid])
 		{
-			lock_release(procdata_lock);
+			rwlock_release_read(procdata_lock);
 			return ECHILD;
 		}
 		else
 		{
-			lock_release(procdata_lock);
+			rwlock_release_read(procdata_lock);
 		
 			return ESRCH;
 		}
 	}
 
+	rwlock_release_read(procdata_lock);
+
+	/*
+	 * CHILD stays valid without procdata_lock: it is only
+	 * destroyed by its parent exiting (that's us) or, once it has
+	 * no parent, by itself.
+	 */
+	lock_acquire(procdata_waitlock);
 	while (child->p_exited == 0)
        	{
-		cv_wait(procdata_cv, procdata_lock);
+		cv_wait(procdata_cv, procdata_waitlock);
 	}
 
 	exitstatus = child->p_exit_code;
 	DEBUG(DB_PROCSYS, "Child (%d) exited (Code %d)\n", pid, exitstatus);
 	
-	lock_release(procdata_lock);
+	lock_release(procdata_waitlock);
 #else
 	/* this is just a stub implementation that always reports an
 		 exit status of 0, regardless of the actual exit status of
@@ -246,13 +255,13 @@ sys_fork(pid_t *retval, struct trapframe *tf)
 {
 	DEBUG(DB_PROCSYS, "Syscall: fork\n");
 
-	lock_acquire(procdata_lock);
+	rwlock_acquire_write(procdata_lock);
 
 	int pid = procdata_find_free_pid(curproc->p_data);
 
 	if (pid < 0)
 	{
-		lock_release(procdata_lock);
+		rwlock_release_write(procdata_lock);
 		DEBUG(DB_PROCSYS, "No PID Available\n");
 		*retval = -1;
 		return ENPROC;
@@ -260,16 +269,16 @@ sys_fork(pid_t *retval, struct trapframe *tf)
 
 	pid_use[pid] = true;
 
-	lock_release(procdata_lock);
+	rwlock_release_write(procdata_lock);
 
 	DEBUG(DB_PROCSYS, "New PID: %d\n", pid);
 
 	struct proc *proc = proc_create_runprogram2(curproc->p_name);
 	if (NULL == proc)
 	{
-		lock_acquire(procdata_lock);
+		rwlock_acquire_write(procdata_lock);
 		pid_use[pid] = false;
-		lock_release(procdata_lock);
+		rwlock_release_write(procdata_lock);
 		*retval = -1;
 		
 		return ENOMEM;
@@ -280,10 +289,10 @@ sys_fork(pid_t *retval, struct trapframe *tf)
 	if (NULL == procdata)
 	{
 		proc_destroy(proc);
-		lock_acquire(procdata_lock);
+		rwlock_acquire_write(procdata_lock);
 		pid_use[pid] = false;
 
-		lock_release(procdata_lock);
+		rwlock_release_write(procdata_lock);
 		*retval = -1;
 		
 		return ENOMEM;
@@ -298,9 +307,9 @@ sys_fork(pid_t *retval, struct trapframe *tf)
 	{
 		proc_destroy(proc);
 		procdata_destroy(procdata);
-		lock_acquire(procdata_lock);
+		rwlock_acquire_write(procdata_lock);
 		pid_use[pid] = false;
-		lock_release(procdata_lock);
+		rwlock_release_write(procdata_lock);
 		*retval = -1;
 		
 		return ENOMEM;
@@ -319,9 +328,9 @@ sys_fork(pid_t *retval, struct trapframe *tf)
 		procdata_destroy(procdata);
 		as_destroy(as);
 		kfree(tf_copy);
-		lock_acquire(procdata_lock);
+		rwlock_acquire_write(procdata_lock);
 		pid_use[pid] = false;
-		lock_release(procdata_lock);
+		rwlock_release_write(procdata_lock);
 		*retval = -1;
 		return result;
 	}
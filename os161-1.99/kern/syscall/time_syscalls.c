@@ -28,9 +28,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include <lamebus/ltimer.h>
 
 /*
  * Example system call: get the time of day.
@@ -56,3 +60,48 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in REQ, rounded up to whole timer ticks, plus
+ * one tick because the current tick is already partly over. Nothing
+ * can interrupt the sleep, so if REM is given, it is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	const int ticks_per_sec = 1000000 / LT_GRANULARITY;
+	int ticks;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	if (ts.tv_sec > 0 || ts.tv_nsec > 0) {
+		/* clamp huge requests before they can overflow the count */
+		if (ts.tv_sec >= 0x7fffffff / ticks_per_sec) {
+			ticks = 0x7fffffff;
+		}
+		else {
+			ticks = (int)ts.tv_sec * ticks_per_sec +
+				DIVROUNDUP(ts.tv_nsec, LT_GRANULARITY * 1000) + 1;
+		}
+		clocknap(ticks);
+	}
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
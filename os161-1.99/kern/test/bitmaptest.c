@@ -101,6 +101,36 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* bitmap_alloc_near must find the one free bit from any goal */
+	for (i=0; i<TESTSIZE; i++) {
+		unsigned j = random() % TESTSIZE;
+
+		bitmap_unmark(b, j);
+		KASSERT(bitmap_alloc_near(b, random() % TESTSIZE, &x)==0);
+		KASSERT(x == j);
+		KASSERT(bitmap_isset(b, x));
+	}
+	KASSERT(bitmap_alloc_near(b, 0, &x)!=0);
+	bitmap_destroy(b);
+
+	/* Bits set through bitmap_getdata must be noticed by the search */
+	b = bitmap_create(TESTSIZE);
+	KASSERT(b != NULL);
+	{
+		unsigned char *raw = bitmap_getdata(b);
+
+		for (i=0; i<TESTSIZE/16; i++) {
+			raw[i] = 0xff;
+		}
+	}
+	i = 0;
+	while (bitmap_alloc(b, &x)==0) {
+		KASSERT(x >= (TESTSIZE/16)*8 && x < TESTSIZE);
+		i++;
+	}
+	KASSERT(i == TESTSIZE - (TESTSIZE/16)*8);
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * emufstest - emufs cache consistency test
+ *
+ * Writes a file on the host through emu0:, reads it back so its name,
+ * size and pages are cached, then changes it through a different
+ * name for the same host file (./emufstest.tmp), the way another
+ * program on the host would, and checks that opening it again by the
+ * original name sees the new contents. Also checks that an exclusive
+ * create of a cached name still fails and that O_TRUNC through a
+ * cached name reaches the host.
+ *
+ * emufs can't remove files, so the (empty) test file is left behind.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+#define ET_NAME		"emu0:emufstest.tmp"
+#define ET_ALIAS	"emu0:./emufstest.tmp"
+#define ET_BUFSIZE	128
+
+/*
+ * Replace the contents of PATH with STR.
+ */
+static
+int
+et_write(const char *path, const char *str)
+{
+	char buf[sizeof(ET_ALIAS)];
+	struct iovec iov;
+	struct uio ku;
+	struct vnode *vn;
+	size_t len = strlen(str);
+	int result;
+
+	strcpy(buf, path);
+	result = vfs_open(buf, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		kprintf("emufstest: open %s: %s\n", path, strerror(result));
+		return result;
+	}
+	uio_kinit(&iov, &ku, (char *)str, len, 0, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		kprintf("emufstest: write %s: %s\n", path, strerror(result));
+	}
+	else if (ku.uio_resid != 0) {
+		kprintf("emufstest: short write to %s\n", path);
+		result = EIO;
+	}
+	vfs_close(vn);
+	return result;
+}
+
+/*
+ * Check that PATH holds exactly STR. Returns nonzero if not.
+ */
+static
+int
+et_check(const char *path, const char *str)
+{
+	char name[sizeof(ET_ALIAS)];
+	char buf[ET_BUFSIZE];
+	struct iovec iov;
+	struct uio ku;
+	struct vnode *vn;
+	size_t len = strlen(str), got;
+	int result;
+
+	KASSERT(len < ET_BUFSIZE);
+
+	strcpy(name, path);
+	result = vfs_open(name, O_RDONLY, 0, &vn);
+	if (result) {
+		kprintf("emufstest: open %s: %s\n", path, strerror(result));
+		return 1;
+	}
+	uio_kinit(&iov, &ku, buf, sizeof(buf) - 1, 0, UIO_READ);
+	result = VOP_READ(vn, &ku);
+	vfs_close(vn);
+	if (result) {
+		kprintf("emufstest: read %s: %s\n", path, strerror(result));
+		return 1;
+	}
+	got = sizeof(buf) - 1 - ku.uio_resid;
+	buf[got] = 0;
+	if (got != len || strcmp(buf, str) != 0) {
+		kprintf("emufstest: %s: got %u bytes, wanted \"%s\"\n",
+			path, (unsigned)got, str);
+		return 1;
+	}
+	return 0;
+}
+
+int
+emufstest(int nargs, char **args)
+{
+	char name[sizeof(ET_NAME)];
+	struct vnode *vn;
+	int result, bad = 0;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("emufstest: caching the file...\n");
+	if (et_write(ET_NAME, "old contents")) {
+		return 1;
+	}
+	bad |= et_check(ET_NAME, "old contents");
+	bad |= et_check(ET_NAME, "old contents");
+
+	kprintf("emufstest: changing it behind the cache's back...\n");
+	if (et_write(ET_ALIAS, "new, longer contents")) {
+		return 1;
+	}
+	bad |= et_check(ET_NAME, "new, longer contents");
+
+	kprintf("emufstest: exclusive create of a cached name...\n");
+	strcpy(name, ET_NAME);
+	result = vfs_open(name, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn);
+	if (result == 0) {
+		kprintf("emufstest: O_EXCL create of existing file worked\n");
+		vfs_close(vn);
+		bad = 1;
+	}
+	else if (result != EEXIST) {
+		kprintf("emufstest: O_EXCL create: %s\n", strerror(result));
+		bad = 1;
+	}
+
+	kprintf("emufstest: truncating through a cached name...\n");
+	if (et_write(ET_NAME, "short")) {
+		return 1;
+	}
+	bad |= et_check(ET_ALIAS, "short");
+	bad |= et_check(ET_NAME, "short");
+
+	et_write(ET_NAME, "");
+
+	kprintf("emufstest %s\n", bad ? "FAILED" : "done");
+	return 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pipetest - pipe and FIFO test code
+ *
+ * A writer thread pushes a few buffers' worth of patterned data
+ * through a pipe in odd-sized chunks while the menu thread reads it
+ * back in different odd-sized chunks, checks it, and checks that it
+ * gets EOF after the writer closes its end. This is done once with
+ * an anonymous pipe, once with a FIFO, and once with the reader
+ * first sleeping in poll until data shows up. Also checks that
+ * writing with no readers fails with EPIPE.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <pipe.h>
+#include <poll.h>
+#include <test.h>
+
+#define PT_TOTAL	(5*4096 + 123)	/* bytes to send */
+#define PT_BUFSIZE	1024
+#define PT_WCHUNK	677		/* writer chunk size (varies) */
+#define PT_RCHUNK	301		/* reader chunk size (varies) */
+#define PT_FIFO		"pipetest"
+
+static struct semaphore *pt_donesem;
+static volatile int pt_writeerr;
+
+static
+unsigned char
+pt_pattern(unsigned pos)
+{
+	return (pos * 7 + pos / 251) & 0xff;
+}
+
+/*
+ * Writer side. Writes PT_TOTAL bytes to VN and closes it.
+ */
+static
+void
+pt_writer(void *data, unsigned long fifo)
+{
+	struct vnode *vn = data;
+	struct iovec iov;
+	struct uio ku;
+	unsigned char *buf;
+	char path[sizeof(PT_FIFO) + 2];
+	unsigned pos, len, i, chunk;
+	int result;
+
+	pt_writeerr = 0;
+	buf = kmalloc(PT_BUFSIZE);
+	if (buf == NULL) {
+		pt_writeerr = ENOMEM;
+		goto done;
+	}
+
+	if (fifo) {
+		strcpy(path, PT_FIFO ":");
+		result = vfs_open(path, O_WRONLY, 0, &vn);
+		if (result) {
+			kprintf("pipetest: writer: open %s: %s\n", PT_FIFO,
+				strerror(result));
+			pt_writeerr = result;
+			kfree(buf);
+			goto done;
+		}
+	}
+
+	chunk = 1;
+	for (pos = 0; pos < PT_TOTAL; pos += len) {
+		len = chunk;
+		if (len > PT_TOTAL - pos) {
+			len = PT_TOTAL - pos;
+		}
+		for (i=0; i<len; i++) {
+			buf[i] = pt_pattern(pos + i);
+		}
+		uio_kinit(&iov, &ku, buf, len, 0, UIO_WRITE);
+		result = VOP_WRITE(vn, &ku);
+		if (result) {
+			kprintf("pipetest: write: %s\n", strerror(result));
+			pt_writeerr = result;
+			break;
+		}
+		if (ku.uio_resid != 0) {
+			kprintf("pipetest: short write\n");
+			pt_writeerr = EIO;
+			break;
+		}
+		chunk = (chunk + PT_WCHUNK) % PT_BUFSIZE + 1;
+	}
+
+	kfree(buf);
+	vfs_close(vn);
+ done:
+	V(pt_donesem);
+}
+
+/*
+ * Reader side. Reads from VN until EOF, checks what it got, and
+ * closes VN. Returns nonzero on failure.
+ */
+static
+int
+pt_read(struct vnode *vn)
+{
+	struct iovec iov;
+	struct uio ku;
+	unsigned char *buf;
+	unsigned pos, len, i, chunk;
+	int result, bad = 0;
+
+	buf = kmalloc(PT_BUFSIZE);
+	if (buf == NULL) {
+		vfs_close(vn);
+		return 1;
+	}
+
+	chunk = 1;
+	pos = 0;
+	while (1) {
+		uio_kinit(&iov, &ku, buf, chunk, 0, UIO_READ);
+		result = VOP_READ(vn, &ku);
+		if (result) {
+			kprintf("pipetest: read: %s\n", strerror(result));
+			bad = 1;
+			break;
+		}
+		len = chunk - ku.uio_resid;
+		if (len == 0) {
+			break;
+		}
+		for (i=0; i<len; i++) {
+			if (buf[i] != pt_pattern(pos + i)) {
+				kprintf("pipetest: bad data at offset %u\n",
+					pos + i);
+				bad = 1;
+				break;
+			}
+		}
+		pos += len;
+		chunk = (chunk + PT_RCHUNK) % PT_BUFSIZE + 1;
+	}
+
+	if (!bad && pos != PT_TOTAL) {
+		kprintf("pipetest: got %u bytes before EOF, expected %u\n",
+			pos, PT_TOTAL);
+		bad = 1;
+	}
+
+	kfree(buf);
+	vfs_close(vn);
+	return bad;
+}
+
+static
+int
+pt_anon(void)
+{
+	struct vnode *rv, *wv;
+	int result, bad;
+
+	kprintf("pipetest: anonymous pipe...\n");
+	result = pipe_create(&rv, &wv);
+	if (result) {
+		kprintf("pipetest: pipe_create: %s\n", strerror(result));
+		return 1;
+	}
+	result = thread_fork("pipetest-w", NULL, pt_writer, wv, 0);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+	bad = pt_read(rv);
+	P(pt_donesem);
+	return bad || pt_writeerr;
+}
+
+static
+int
+pt_fifo(void)
+{
+	struct vnode *rv;
+	char path[sizeof(PT_FIFO) + 2];
+	int result, bad;
+
+	kprintf("pipetest: FIFO %s:...\n", PT_FIFO);
+	result = vfs_mkfifo(PT_FIFO);
+	if (result && result != EEXIST) {
+		kprintf("pipetest: vfs_mkfifo: %s\n", strerror(result));
+		return 1;
+	}
+	result = thread_fork("pipetest-w", NULL, pt_writer, NULL, 1);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+	strcpy(path, PT_FIFO ":");
+	result = vfs_open(path, O_RDONLY, 0, &rv);
+	if (result) {
+		kprintf("pipetest: open %s: %s\n", PT_FIFO, strerror(result));
+		/* the writer is stuck waiting for us; leave it */
+		return 1;
+	}
+	bad = pt_read(rv);
+	P(pt_donesem);
+	return bad || pt_writeerr;
+}
+
+static
+int
+pt_poll(void)
+{
+	struct vnode *rv, *wv;
+	struct pollwait pw;
+	int result, revents, bad = 0;
+
+	kprintf("pipetest: poll...\n");
+	result = pipe_create(&rv, &wv);
+	if (result) {
+		kprintf("pipetest: pipe_create: %s\n", strerror(result));
+		return 1;
+	}
+	result = pollwait_init(&pw, -1);
+	if (result) {
+		kprintf("pipetest: pollwait_init: %s\n", strerror(result));
+		vfs_close(rv);
+		vfs_close(wv);
+		return 1;
+	}
+
+	result = VOP_POLL(wv, POLLOUT, NULL, &revents);
+	if (result || revents != POLLOUT) {
+		kprintf("pipetest: empty pipe not writable\n");
+		bad = 1;
+	}
+	result = VOP_POLL(rv, POLLIN, &pw, &revents);
+	if (result || revents != 0) {
+		kprintf("pipetest: empty pipe readable\n");
+		bad = 1;
+	}
+
+	result = thread_fork("pipetest-w", NULL, pt_writer, wv, 0);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+	pollwait_sleep(&pw);
+	result = VOP_POLL(rv, POLLIN, NULL, &revents);
+	if (result || (revents & POLLIN) == 0) {
+		kprintf("pipetest: woken from poll with no data\n");
+		bad = 1;
+	}
+	pollwait_cleanup(&pw);
+
+	bad |= pt_read(rv);
+	P(pt_donesem);
+	return bad || pt_writeerr;
+}
+
+static
+int
+pt_broken(void)
+{
+	struct vnode *rv, *wv;
+	struct iovec iov;
+	struct uio ku;
+	char c = 0;
+	int result;
+
+	kprintf("pipetest: broken pipe...\n");
+	result = pipe_create(&rv, &wv);
+	if (result) {
+		kprintf("pipetest: pipe_create: %s\n", strerror(result));
+		return 1;
+	}
+	vfs_close(rv);
+	uio_kinit(&iov, &ku, &c, 1, 0, UIO_WRITE);
+	result = VOP_WRITE(wv, &ku);
+	vfs_close(wv);
+	if (result != EPIPE) {
+		kprintf("pipetest: write with no reader: expected EPIPE, "
+			"got %s\n", result ? strerror(result) : "success");
+		return 1;
+	}
+	return 0;
+}
+
+int
+pipetest(int nargs, char **args)
+{
+	int bad = 0;
+
+	(void)nargs;
+	(void)args;
+
+	if (pt_donesem == NULL) {
+		pt_donesem = sem_create("pipetest", 0);
+		if (pt_donesem == NULL) {
+			panic("pipetest: sem_create failed\n");
+		}
+	}
+
+	bad |= pt_anon();
+	bad |= pt_poll();
+	bad |= pt_broken();
+	bad |= pt_fifo();
+
+	kprintf("pipetest %s\n", bad ? "FAILED" : "done");
+	return 0;
+}
@@ -32,11 +32,17 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
 
 #define NTHREADS  8
+#define AFFTHREADS 2		/* affinity test threads per cpu */
+#define AFFROUNDS  20		/* times each one sleeps and yields */
 
 static struct semaphore *tsem = NULL;
 
@@ -144,3 +150,90 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Affinity test: for each cpu start AFFTHREADS threads wherever they
+ * land, have them ask for that cpu, and check that they get moved
+ * there and then stay put while they sleep and yield, with the
+ * others competing for the same cpus.
+ */
+
+static struct spinlock aff_lock = SPINLOCK_INITIALIZER;
+static unsigned aff_bad;
+
+static
+void
+affthread(void *cp, unsigned long num)
+{
+	struct cpu *c = cp;
+	unsigned bad = 0;
+	int i;
+
+	thread_setaffinity(c);
+	if (curcpu->c_self != c) {
+		kprintf("affinitytest: thread %lu on cpu %u, wanted %u\n",
+			num, curcpu->c_number, c->c_number);
+		bad++;
+	}
+
+	for (i=0; i<AFFROUNDS && bad == 0; i++) {
+		clocknap(1);
+		thread_yield();
+		if (curcpu->c_self != c) {
+			kprintf("affinitytest: thread %lu moved to cpu %u, "
+				"wanted %u\n", num, curcpu->c_number,
+				c->c_number);
+			bad++;
+		}
+	}
+
+	thread_setaffinity(NULL);
+
+	spinlock_acquire(&aff_lock);
+	aff_bad += bad;
+	spinlock_release(&aff_lock);
+	V(tsem);
+}
+
+int
+affinitytest(int nargs, char **args)
+{
+	char name[16];
+	struct cpu *c;
+	unsigned i, n, num;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting affinity test...\n");
+
+	aff_bad = 0;
+	num = 0;
+	for (i=0; (c = thread_getcpu(i)) != NULL; i++) {
+		for (n=0; n<AFFTHREADS; n++) {
+			snprintf(name, sizeof(name), "afftest%u", num);
+			result = thread_fork(name, NULL, affthread, c, num);
+			if (result) {
+				panic("affinitytest: thread_fork failed %s\n",
+				      strerror(result));
+			}
+			num++;
+		}
+	}
+
+	for (i=0; i<num; i++) {
+		P(tsem);
+	}
+
+	if (aff_bad > 0) {
+		kprintf("Affinity test FAILED: %u threads misplaced\n",
+			aff_bad);
+	}
+	else {
+		kprintf("Affinity test done (%u threads on %u cpus).\n",
+			num, num / AFFTHREADS);
+	}
+	return 0;
+}
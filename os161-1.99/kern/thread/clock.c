@@ -30,8 +30,10 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
+#include <poll.h>
 #include <thread.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
@@ -54,24 +56,40 @@
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
-/*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-/*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
- */
-static struct wchan *minibolt;
-
 /* 
- * number of minibolts per second
+ * number of timer ticks per second
  */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+#define MINI_PER_SECOND (1000000/LT_GRANULARITY)
 
 /*
- * minibolt countdown
+ * Sleeping threads wait in a hierarchical timer wheel, so each timer
+ * tick only has to look at the threads whose time is up, not at
+ * every sleeper.
+ *
+ * Each of the TW_LEVELS levels has TW_SLOTS slots. A slot at level 0
+ * holds the threads due on one particular tick; a slot at level L
+ * covers TW_SLOTS^L ticks. A thread goes in the lowest level whose
+ * span reaches its deadline. When the tick count crosses a slot
+ * boundary at level L, that slot's threads are "cascaded", that is,
+ * reinserted, which moves them down a level, and eventually they are
+ * woken from level 0. Deadlines further off than the whole wheel go
+ * in the top level and are simply reinserted when they come around.
+ *
+ * Each sleeping thread's deadline is kept in t_deadline, and
+ * t_timernext links the threads in a slot. The sleepers all sleep on
+ * timer_wchan, and are woken one at a time with wchan_wakethread.
+ * timer_lock protects the wheel and the tick count.
  */
-static int minicount;
+#define TW_BITS		6
+#define TW_SLOTS	(1U << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	3
+#define TW_RANGE	(1U << (TW_BITS * TW_LEVELS))
+
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+static struct thread *timer_wheel[TW_LEVELS][TW_SLOTS];
+static uint32_t timer_ticks;
+static struct wchan *timer_wchan;
 
 /*
  * Setup.
@@ -79,17 +97,47 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	timer_wchan = wchan_create("timer");
+	if (timer_wchan == NULL) {
+		panic("Couldn't create timer wchan\n");
 	}
-	minicount = MINI_PER_SECOND;
 	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	KASSERT(MINI_PER_SECOND > 0);
+}
+
+/*
+ * Put T in the wheel according to t_deadline. Call with timer_lock
+ * held. A thread that is already due goes in the current level-0
+ * slot, which (see timerclock) is emptied after cascading.
+ */
+static
+void
+timer_insert(struct thread *t)
+{
+	int32_t delta;
+	uint32_t when;
+	unsigned level, slot;
+
+	when = t->t_deadline;
+	delta = (int32_t)(when - timer_ticks);
+	if (delta < 0) {
+		when = timer_ticks;
+		delta = 0;
+	}
+	else if ((uint32_t)delta >= TW_RANGE) {
+		when = timer_ticks + TW_RANGE - 1;
+		delta = TW_RANGE - 1;
+	}
+
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if ((uint32_t)delta < (1U << (TW_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = (when >> (TW_BITS * level)) & TW_MASK;
+
+	t->t_timernext = timer_wheel[level][slot];
+	timer_wheel[level][slot] = t;
 }
 
 /*
@@ -99,13 +147,45 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct thread *t, *list;
+	unsigned level, slot;
+	uint32_t now;
+
+	spinlock_acquire(&timer_lock);
+	now = ++timer_ticks;
+
+	/* Cascade the higher levels whose slot boundary we just crossed */
+	for (level = TW_LEVELS - 1; level > 0; level--) {
+		if ((now & ((1U << (TW_BITS * level)) - 1)) != 0) {
+			continue;
+		}
+		slot = (now >> (TW_BITS * level)) & TW_MASK;
+		list = timer_wheel[level][slot];
+		timer_wheel[level][slot] = NULL;
+		while (list != NULL) {
+			t = list;
+			list = t->t_timernext;
+			timer_insert(t);
+		}
 	}
+
+	/* Take everything that's due now */
+	list = timer_wheel[0][now & TW_MASK];
+	timer_wheel[0][now & TW_MASK] = NULL;
+	spinlock_release(&timer_lock);
+
+	/*
+	 * Wake them. Get the next pointer first; once woken, a thread
+	 * may run (and sleep again) at once.
+	 */
+	while (list != NULL) {
+		t = list;
+		list = t->t_timernext;
+		wchan_wakethread(timer_wchan, t);
+	}
+
+	/* Run down poll/select timeouts */
+	poll_timerclock();
 }
 
 /*
@@ -135,23 +215,33 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs > 0) {
+		clocknap(num_secs * MINI_PER_SECOND);
+	}
 }
 
 /*
  * Suspend execution for num_ticks timer ticks.
  *  (one tick every LT_GRANULARITY usec)
+ *
+ * We get on the wait channel before letting go of timer_lock, so if
+ * timerclock finds us due right away, wchan_wakethread waits for us
+ * to be asleep.
  */
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	struct thread *cur;
+
+	if (num_ticks <= 0) {
+		return;
+	}
+
+	cur = curthread;
+	spinlock_acquire(&timer_lock);
+	cur->t_deadline = timer_ticks + (uint32_t)num_ticks;
+	timer_insert(cur);
+	wchan_lock(timer_wchan);
+	spinlock_release(&timer_lock);
+	wchan_sleep(timer_wchan);
 }
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_MAX	128	/* number of distinct lock names tracked */
+
+volatile bool lockstat_enabled = false;
+
+/*
+ * The table. Entries are only ever added, never removed, so once an
+ * entry pointer has been handed out it stays good. The spinlock
+ * protects adding entries; it has no name, so it isn't itself
+ * tracked (which would recurse).
+ */
+static struct lockstat lockstat_table[LOCKSTAT_MAX];
+static unsigned lockstat_count;
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Check if NAME matches the (possibly truncated) name in LS.
+ */
+static
+bool
+lockstat_namematch(struct lockstat *ls, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN - 1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+struct lockstat *
+lockstat_get(const char *name, const char *kind)
+{
+	struct lockstat *ls;
+	unsigned i;
+
+	spinlock_acquire(&lockstat_lock);
+	for (i=0; i<lockstat_count; i++) {
+		ls = &lockstat_table[i];
+		if (lockstat_namematch(ls, name) &&
+		    !strcmp(ls->ls_kind, kind)) {
+			spinlock_release(&lockstat_lock);
+			return ls;
+		}
+	}
+	if (lockstat_count == LOCKSTAT_MAX) {
+		spinlock_release(&lockstat_lock);
+		return NULL;
+	}
+
+	ls = &lockstat_table[lockstat_count++];
+	for (i=0; i<LOCKSTAT_NAMELEN - 1 && name[i] != 0; i++) {
+		ls->ls_name[i] = name[i];
+	}
+	ls->ls_name[i] = 0;
+	ls->ls_kind = kind;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_spins = 0;
+	ls->ls_sleepns = 0;
+	ls->ls_maxholdns = 0;
+	spinlock_release(&lockstat_lock);
+
+	return ls;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+void
+lockstat_held(struct lockstat *ls, uint64_t since)
+{
+	uint64_t held;
+
+	if (ls == NULL) {
+		return;
+	}
+	held = lockstat_now() - since;
+	if (held > ls->ls_maxholdns) {
+		ls->ls_maxholdns = held;
+	}
+}
+
+void
+lockstat_enable(bool on)
+{
+	lockstat_enabled = on;
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	unsigned i;
+
+	spinlock_acquire(&lockstat_lock);
+	for (i=0; i<lockstat_count; i++) {
+		ls = &lockstat_table[i];
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_spins = 0;
+		ls->ls_sleepns = 0;
+		ls->ls_maxholdns = 0;
+	}
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * Print the MAX most contended locks. The counters are read without
+ * locking (we can't kprintf holding a spinlock anyway); they may be
+ * changing underfoot, but only a little.
+ */
+void
+lockstat_print(unsigned max)
+{
+	unsigned char order[LOCKSTAT_MAX];
+	struct lockstat *ls;
+	unsigned i, j, n, t;
+
+	spinlock_acquire(&lockstat_lock);
+	n = lockstat_count;
+	spinlock_release(&lockstat_lock);
+
+	/* Insertion sort by contended acquisitions, most first */
+	for (i=0; i<n; i++) {
+		order[i] = i;
+		for (j=i; j>0; j--) {
+			if (lockstat_table[order[j-1]].ls_contended >=
+			    lockstat_table[order[j]].ls_contended) {
+				break;
+			}
+			t = order[j];
+			order[j] = order[j-1];
+			order[j-1] = t;
+		}
+	}
+
+	kprintf("%-23s %-4s %10s %10s %12s %10s %10s\n",
+		"name", "kind", "acquires", "contended", "spins",
+		"sleep(us)", "maxhold(us)");
+	for (i=j=0; i<n && j<max; i++) {
+		ls = &lockstat_table[order[i]];
+		if (ls->ls_acquires == 0) {
+			continue;
+		}
+		j++;
+		kprintf("%-23s %-4s %10llu %10llu %12llu %10llu %10llu\n",
+			ls->ls_name, ls->ls_kind,
+			ls->ls_acquires, ls->ls_contended, ls->ls_spins,
+			ls->ls_sleepns / 1000, ls->ls_maxholdns / 1000);
+	}
+	if (!lockstat_enabled) {
+		kprintf("(collection is off)\n");
+	}
+}
@@ -36,11 +36,42 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
+ *
+ * There are two kinds. Ordinary spinlocks are test-and-set locks:
+ * lk_lock is 1 while held. Ticket locks hand out tickets from
+ * lk_nextticket, and lk_lock holds the number of the ticket being
+ * served; releasing the lock serves the next ticket. Ticket locks
+ * are FIFO and there's only one atomic operation per acquire,
+ * however many cpus are waiting.
+ *
+ * Either way, waiting cpus back off between looks at the lock word,
+ * to cut down on memory traffic: exponentially (up to a limit) for
+ * test-and-set locks, and in proportion to their place in line for
+ * ticket locks.
  */
 
+/* Backoff delays, in trips around an empty loop. */
+#define SPINLOCK_BACKOFF_MIN	4
+#define SPINLOCK_BACKOFF_MAX	1024
+#define SPINLOCK_TICKET_DELAY	16
+
+/*
+ * Spin for a while without touching the lock.
+ */
+static
+void
+spinlock_backoff(unsigned count)
+{
+	volatile unsigned i;
+
+	for (i=0; i<count; i++) {
+		/* nothing */
+	}
+}
 
 /*
  * Initialize spinlock.
@@ -49,7 +80,29 @@ void
 spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_nextticket, 0);
+	lk->lk_isticket = false;
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lk->lk_name = NULL;
+	lk->lk_stat = NULL;
+	lk->lk_acqtime = 0;
+#endif
+}
+
+/*
+ * Initialize spinlock as a ticket lock.
+ */
+void
+spinlock_init_ticket(struct spinlock *lk, const char *name)
+{
+	spinlock_init(lk);
+	lk->lk_isticket = true;
+#if OPT_LOCKSTAT
+	lk->lk_name = name;
+#else
+	(void)name;
+#endif
 }
 
 /*
@@ -59,7 +112,13 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	if (lk->lk_isticket) {
+		KASSERT(spinlock_data_get(&lk->lk_lock) ==
+			spinlock_data_get(&lk->lk_nextticket));
+	}
+	else {
+		KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	}
 }
 
 /*
@@ -73,6 +132,11 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	unsigned backoff, spins;
+#if OPT_LOCKSTAT
+	struct lockstat *ls;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,6 +151,27 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+	spins = 0;
+	if (lk->lk_isticket) {
+		/*
+		 * Take a ticket and wait for it to come up. The
+		 * further back in line we are, the longer we can
+		 * wait before looking again.
+		 */
+		ticket = spinlock_data_fetchinc(&lk->lk_nextticket);
+		while (1) {
+			serving = spinlock_data_get(&lk->lk_lock);
+			if (serving == ticket) {
+				break;
+			}
+			spins++;
+			spinlock_backoff((ticket - serving) *
+					 SPINLOCK_TICKET_DELAY);
+		}
+		goto gotit;
+	}
+
+	backoff = SPINLOCK_BACKOFF_MIN;
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -97,17 +182,42 @@ spinlock_acquire(struct spinlock *lk)
 		 * previous value. If that value was 0, the lock was
 		 * previously unheld and we now own it. If it was 1,
 		 * we don't.
+		 *
+		 * Each time we lose, wait twice as long (up to a
+		 * limit) before trying again.
 		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		if (spinlock_data_get(&lk->lk_lock) == 0 &&
+		    spinlock_data_testandset(&lk->lk_lock) == 0) {
+			break;
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+		spins++;
+		spinlock_backoff(backoff);
+		if (backoff < SPINLOCK_BACKOFF_MAX) {
+			backoff *= 2;
 		}
-		break;
 	}
 
+ gotit:
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	if (lockstat_enabled && lk->lk_name != NULL) {
+		if (lk->lk_stat == NULL) {
+			lk->lk_stat = lockstat_get(lk->lk_name, "spin");
+		}
+		ls = lk->lk_stat;
+		if (ls != NULL) {
+			ls->ls_acquires++;
+			if (spins > 0) {
+				ls->ls_contended++;
+				ls->ls_spins += spins;
+			}
+			lk->lk_acqtime = lockstat_now();
+		}
+	}
+#else
+	(void)spins;
+#endif
 }
 
 /*
@@ -121,8 +231,22 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	if (lk->lk_acqtime != 0) {
+		lockstat_held(lk->lk_stat, lk->lk_acqtime);
+		lk->lk_acqtime = 0;
+	}
+#endif
+
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_isticket) {
+		/* Only the holder writes lk_lock, so this needn't be atomic */
+		spinlock_data_set(&lk->lk_lock,
+				  spinlock_data_get(&lk->lk_lock) + 1);
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -37,8 +37,42 @@
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+
+#if OPT_LOCKSTAT
+/*
+ * Count an acquisition (or, for a CV, a wait) in *LSP, looking the
+ * entry up by NAME the first time. Returns the entry, or NULL if
+ * statistics are off or the table is full.
+ */
+static
+struct lockstat *
+synch_lockstat(struct lockstat **lsp, const char *name, const char *kind,
+	       bool contended, unsigned spins, uint64_t sleepns)
+{
+	struct lockstat *ls;
+
+	if (!lockstat_enabled) {
+		return NULL;
+	}
+	if (*lsp == NULL) {
+		*lsp = lockstat_get(name, kind);
+	}
+	ls = *lsp;
+	if (ls != NULL) {
+		ls->ls_acquires++;
+		if (contended) {
+			ls->ls_contended++;
+		}
+		ls->ls_spins += spins;
+		ls->ls_sleepns += sleepns;
+	}
+	return ls;
+}
+#endif /* OPT_LOCKSTAT */
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,6 +105,7 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+	sem->sem_nwaiters = 0;
 
         return sem;
 }
@@ -118,6 +153,7 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
+		sem->sem_nwaiters++;
 		wchan_lock(sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
                 wchan_sleep(sem->sem_wchan);
@@ -138,7 +174,15 @@ V(struct semaphore *sem)
 
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	/*
+	 * The waiter count is kept under sem_lock, and a thread is on
+	 * the wchan before it lets go of sem_lock, so if the count is
+	 * zero nobody can be asleep and we can skip the wchan.
+	 */
+	if (sem->sem_nwaiters > 0) {
+		sem->sem_nwaiters--;
+		wchan_wakeone(sem->sem_wchan);
+	}
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -177,6 +221,12 @@ lock_create(const char *name)
 	spinlock_init(&lock->lk_spnlk);
 	lock->lk_volatile = 1;
 	lock->lk_hldr = NULL;
+	lock->lk_hldrcpu = NULL;
+	lock->lk_nwaiters = 0;
+#if OPT_LOCKSTAT
+	lock->lk_stat = NULL;
+	lock->lk_acqtime = 0;
+#endif
         return lock;
 }
 
@@ -195,54 +245,117 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Locks are adaptive: if the holder is running on another cpu it will
+ * probably let go soon, so spin waiting for it rather than paying for
+ * two context switches. If the holder isn't running (it's asleep, or
+ * waiting on a run queue) spinning is pointless, so sleep.
+ *
+ * On release, if anyone is asleep waiting, the lock is handed
+ * directly to the first of them instead of being freed; otherwise
+ * all the sleepers would wake up and race for it, and all but one
+ * would go back to sleep.
+ */
 void
 lock_acquire(struct lock *lock)
 {
-        // ~ASST1
-	
+	struct thread *me, *owner;
+	struct cpu *ownercpu;
+	bool contended;
+	unsigned spins;
+	uint64_t sleepns;
+#if OPT_LOCKSTAT
+	uint64_t sleepstart;
+#endif
+
 	KASSERT(lock != NULL);
 
 	if (CURCPU_EXISTS())
 	{
 		KASSERT(lock->lk_hldr != curthread);
+		me = curthread;
+	}
+
+	else
+	{
+		me = NULL;
 	}
 
 	KASSERT(curthread->t_in_interrupt == false);
 
-        spinlock_acquire(&lock->lk_spnlk);
+	contended = false;
+	spins = 0;
+	sleepns = 0;
 
+        spinlock_acquire(&lock->lk_spnlk);
 
 	while(1)
 	{
-		if (lock->lk_volatile == 0)
+		if (lock->lk_volatile > 0)
 		{
-			wchan_lock(lock->lk_wchn);
-			spinlock_release(&lock->lk_spnlk);
-
-			wchan_sleep(lock->lk_wchn);
-			
-			spinlock_acquire(&lock->lk_spnlk);
+			/* free; take it */
+			lock->lk_volatile = 0;
+			lock->lk_hldr = me;
+			break;
 		}
 
-		else
+		if (me != NULL && lock->lk_hldr == me)
 		{
+			/* handed to us by lock_release */
 			break;
 		}
-	}
 
-	KASSERT(lock->lk_volatile > 0);
+		contended = true;
+		owner = lock->lk_hldr;
+		ownercpu = lock->lk_hldrcpu;
+		if (ownercpu != NULL && ownercpu != curcpu->c_self &&
+		    thread_isrunning_on(ownercpu, owner))
+		{
+			/*
+			 * Spin (without the spinlock, so interrupts
+			 * are on and the owner can get in to release)
+			 * until the owner lets go or stops running.
+			 */
+			spinlock_release(&lock->lk_spnlk);
+			while (lock->lk_hldr == owner &&
+			       thread_isrunning_on(ownercpu, owner))
+			{
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_spnlk);
+			continue;
+		}
 
-	lock->lk_volatile = 0;
+		lock->lk_nwaiters++;
+		wchan_lock(lock->lk_wchn);
+		spinlock_release(&lock->lk_spnlk);
 
-	if (CURCPU_EXISTS())
-	{
-		lock->lk_hldr = curthread;
+#if OPT_LOCKSTAT
+		sleepstart = lockstat_enabled ? lockstat_now() : 0;
+		wchan_sleep(lock->lk_wchn);
+		if (sleepstart != 0) {
+			sleepns += lockstat_now() - sleepstart;
+		}
+#else
+		wchan_sleep(lock->lk_wchn);
+#endif
+
+		spinlock_acquire(&lock->lk_spnlk);
 	}
 
-	else
-	{
-		lock->lk_hldr = NULL;
+	KASSERT(lock->lk_volatile == 0);
+	lock->lk_hldrcpu = (me != NULL) ? curcpu->c_self : NULL;
+
+#if OPT_LOCKSTAT
+	if (synch_lockstat(&lock->lk_stat, lock->lk_name, "lock",
+			   contended, spins, sleepns) != NULL) {
+		lock->lk_acqtime = lockstat_now();
 	}
+#else
+	(void)contended;
+	(void)spins;
+	(void)sleepns;
+#endif
 
 	spinlock_release(&lock->lk_spnlk);
 }
@@ -250,7 +363,7 @@ lock_acquire(struct lock *lock)
 void
 lock_release(struct lock *lock)
 {
-        // ~ASST1
+	struct thread *next;
 
         KASSERT(lock != NULL);
 	spinlock_acquire(&lock->lk_spnlk);
@@ -258,9 +371,40 @@ lock_release(struct lock *lock)
 	{
 		KASSERT(lock->lk_hldr == curthread);
 	}*/
-	lock->lk_hldr = NULL;
-	lock->lk_volatile = lock->lk_volatile + 1;
-	wchan_wakeone(lock->lk_wchn);
+#if OPT_LOCKSTAT
+	if (lock->lk_acqtime != 0) {
+		lockstat_held(lock->lk_stat, lock->lk_acqtime);
+		lock->lk_acqtime = 0;
+	}
+#endif
+	lock->lk_hldrcpu = NULL;
+	/*
+	 * Hand the lock to the first sleeper, if any. It can't look
+	 * at the lock until we release the spinlock, so it's fine to
+	 * set lk_hldr after waking it.
+	 *
+	 * Sleepers are counted under the spinlock (see the comment in
+	 * V), so in the common uncontended case we don't need to
+	 * touch the wchan at all.
+	 */
+	next = NULL;
+	if (lock->lk_nwaiters > 0)
+	{
+		lock->lk_nwaiters--;
+		next = wchan_wakeone_thread(lock->lk_wchn);
+		KASSERT(next != NULL);
+	}
+
+	if (next != NULL)
+	{
+		lock->lk_hldr = next;
+	}
+
+	else
+	{
+		lock->lk_hldr = NULL;
+		lock->lk_volatile = lock->lk_volatile + 1;
+	}
 	spinlock_release(&lock->lk_spnlk);
 }
 
@@ -310,6 +454,10 @@ cv_create(const char *name)
 
 		return NULL;
 	}
+	cv->cv_nwaiters = 0;
+#if OPT_LOCKSTAT
+	cv->cv_stat = NULL;
+#endif
         
        return cv;
 }
@@ -330,13 +478,33 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+#if OPT_LOCKSTAT
+	uint64_t sleepstart;
+#endif
+
         // ~ASST1
 	
 	KASSERT(lock != NULL);
 	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+	/*
+	 * The waiter count is protected by the lock. We're on the
+	 * wchan before the lock is released, so a signaller that
+	 * sees the count can always find us there.
+	 */
+	cv->cv_nwaiters++;
 	wchan_lock(cv->cv_wchn);
 	lock_release(lock);
+#if OPT_LOCKSTAT
+	sleepstart = lockstat_enabled ? lockstat_now() : 0;
+	wchan_sleep(cv->cv_wchn);
+	if (sleepstart != 0) {
+		synch_lockstat(&cv->cv_stat, cv->cv_name, "cv", true, 0,
+			       lockstat_now() - sleepstart);
+	}
+#else
 	wchan_sleep(cv->cv_wchn);
+#endif
 	lock_acquire(lock);
 }
 
@@ -348,7 +516,10 @@ cv_signal(struct cv *cv, struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(cv != NULL);
 	KASSERT(lock_do_i_hold(lock));
-	wchan_wakeone(cv->cv_wchn);
+	if (cv->cv_nwaiters > 0) {
+		cv->cv_nwaiters--;
+		wchan_wakeone(cv->cv_wchn);
+	}
 }
 
 void
@@ -357,7 +528,241 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	// ~ASST1
 	
 	KASSERT(cv != NULL);
-  	lock_release(lock);
-  	wchan_wakeall(cv->cv_wchn);
-  	lock_acquire(lock);
+	KASSERT(lock_do_i_hold(lock));
+	if (cv->cv_nwaiters > 0) {
+		cv->cv_nwaiters = 0;
+		wchan_wakeall(cv->cv_wchn);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+//
+// A thread that has to wait is always woken by a releaser that has
+// already given it the lock: waiting readers are all let in at once
+// (and counted in rwlk_readers) when a writer releases, and a waiting
+// writer is handed the lock by the last reader or writer out. So a
+// woken thread never has to recheck anything. The sleeper counts are
+// kept under the spinlock, as for semaphores.
+//
+// For statistics, read and write acquisitions go in one "rw" entry.
+// Only write holds are timed, since read holds aren't tracked per
+// thread.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlk_name = kstrdup(name);
+	if (rw->rwlk_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rwlk_rwchn = wchan_create(rw->rwlk_name);
+	if (rw->rwlk_rwchn == NULL) {
+		kfree(rw->rwlk_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rwlk_wwchn = wchan_create(rw->rwlk_name);
+	if (rw->rwlk_wwchn == NULL) {
+		wchan_destroy(rw->rwlk_rwchn);
+		kfree(rw->rwlk_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rwlk_spnlk);
+	rw->rwlk_readers = 0;
+	rw->rwlk_writing = false;
+	rw->rwlk_writer = NULL;
+	rw->rwlk_rwaiting = 0;
+	rw->rwlk_wwaiting = 0;
+#if OPT_LOCKSTAT
+	rw->rwlk_stat = NULL;
+	rw->rwlk_acqtime = 0;
+#endif
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rwlk_readers == 0);
+	KASSERT(!rw->rwlk_writing);
+
+	spinlock_cleanup(&rw->rwlk_spnlk);
+	wchan_destroy(rw->rwlk_wwchn);
+	wchan_destroy(rw->rwlk_rwchn);
+	kfree(rw->rwlk_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+#if OPT_LOCKSTAT
+	uint64_t sleepstart;
+#endif
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlk_spnlk);
+	if (rw->rwlk_writing || rw->rwlk_wwaiting > 0) {
+		rw->rwlk_rwaiting++;
+		wchan_lock(rw->rwlk_rwchn);
+		spinlock_release(&rw->rwlk_spnlk);
+#if OPT_LOCKSTAT
+		sleepstart = lockstat_enabled ? lockstat_now() : 0;
+		wchan_sleep(rw->rwlk_rwchn);
+		synch_lockstat(&rw->rwlk_stat, rw->rwlk_name, "rw", true, 0,
+			       sleepstart != 0 ?
+			       lockstat_now() - sleepstart : 0);
+#else
+		wchan_sleep(rw->rwlk_rwchn);
+#endif
+		/* rwlock_release_write let us in */
+		return;
+	}
+	rw->rwlk_readers++;
+#if OPT_LOCKSTAT
+	synch_lockstat(&rw->rwlk_stat, rw->rwlk_name, "rw", false, 0, 0);
+#endif
+	spinlock_release(&rw->rwlk_spnlk);
+}
+
+/*
+ * Give the lock to the first waiting writer. Spinlock must be held.
+ */
+static
+void
+rwlock_wake_writer(struct rwlock *rw)
+{
+	struct thread *t;
+
+	KASSERT(rw->rwlk_wwaiting > 0);
+	rw->rwlk_wwaiting--;
+	t = wchan_wakeone_thread(rw->rwlk_wwchn);
+	KASSERT(t != NULL);
+	rw->rwlk_writing = true;
+	rw->rwlk_writer = t;
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlk_spnlk);
+	KASSERT(rw->rwlk_readers > 0);
+	KASSERT(!rw->rwlk_writing);
+	rw->rwlk_readers--;
+	if (rw->rwlk_readers == 0 && rw->rwlk_wwaiting > 0) {
+		rwlock_wake_writer(rw);
+	}
+	spinlock_release(&rw->rwlk_spnlk);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	bool contended;
+	uint64_t sleepns;
+#if OPT_LOCKSTAT
+	uint64_t sleepstart;
+#endif
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rwlk_writer != curthread);
+
+	contended = false;
+	sleepns = 0;
+
+	spinlock_acquire(&rw->rwlk_spnlk);
+	if (rw->rwlk_writing || rw->rwlk_readers > 0) {
+		contended = true;
+		rw->rwlk_wwaiting++;
+		wchan_lock(rw->rwlk_wwchn);
+		spinlock_release(&rw->rwlk_spnlk);
+#if OPT_LOCKSTAT
+		sleepstart = lockstat_enabled ? lockstat_now() : 0;
+		wchan_sleep(rw->rwlk_wwchn);
+		if (sleepstart != 0) {
+			sleepns = lockstat_now() - sleepstart;
+		}
+#else
+		wchan_sleep(rw->rwlk_wwchn);
+#endif
+		/*
+		 * Handed to us by rwlock_wake_writer, which sets
+		 * rwlk_writer after waking us; it's only certain to
+		 * be visible once we've been through the spinlock.
+		 */
+		spinlock_acquire(&rw->rwlk_spnlk);
+		KASSERT(rw->rwlk_writer == curthread);
+	}
+	else {
+		rw->rwlk_writing = true;
+		rw->rwlk_writer = curthread;
+	}
+
+#if OPT_LOCKSTAT
+	if (synch_lockstat(&rw->rwlk_stat, rw->rwlk_name, "rw",
+			   contended, 0, sleepns) != NULL) {
+		rw->rwlk_acqtime = lockstat_now();
+	}
+#else
+	(void)contended;
+	(void)sleepns;
+#endif
+
+	spinlock_release(&rw->rwlk_spnlk);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlk_spnlk);
+	KASSERT(rw->rwlk_writing);
+	KASSERT(rw->rwlk_writer == curthread);
+	KASSERT(rw->rwlk_readers == 0);
+#if OPT_LOCKSTAT
+	if (rw->rwlk_acqtime != 0) {
+		lockstat_held(rw->rwlk_stat, rw->rwlk_acqtime);
+		rw->rwlk_acqtime = 0;
+	}
+#endif
+	rw->rwlk_writing = false;
+	rw->rwlk_writer = NULL;
+	if (rw->rwlk_rwaiting > 0) {
+		/* Let all the waiting readers in */
+		rw->rwlk_readers = rw->rwlk_rwaiting;
+		rw->rwlk_rwaiting = 0;
+		wchan_wakeall(rw->rwlk_rwchn);
+	}
+	else if (rw->rwlk_wwaiting > 0) {
+		rwlock_wake_writer(rw);
+	}
+	spinlock_release(&rw->rwlk_spnlk);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	return rw->rwlk_writing && rw->rwlk_writer == curthread;
 }
@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
 
 #include "opt-synchprobs.h"
 
@@ -111,9 +112,68 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Per-cpu cache of dead threads.
+ *
+ * Rather than freeing a dead thread and its stack, thread_destroy
+ * keeps up to THREAD_CACHE_MAX of them on the current cpu for
+ * thread_create to reuse, so forking doesn't need two trips through
+ * kmalloc. The stack's guard band was set up when it was first
+ * allocated and is checked on the way in, so it's good as it is.
+ *
+ * The cache is only touched by its own cpu, so disabling interrupts
+ * (which also keeps us from being switched to another cpu) is enough
+ * to protect it.
+ */
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct thread *thread;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	return thread;
+}
+
+static
+void
+thread_cache_put(struct thread *thread)
+{
+	int spl;
+
+	if (thread->t_stack != NULL) {
+		thread_checkstack(thread);
+		threadlistnode_init(&thread->t_listnode, thread);
+
+		spl = splhigh();
+		if (curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX) {
+			threadlist_addtail(&curcpu->c_threadcache, thread);
+			thread = NULL;
+		}
+		splx(spl);
+
+		if (thread == NULL) {
+			return;
+		}
+		threadlistnode_cleanup(&thread->t_listnode);
+		kfree(thread->t_stack);
+	}
+	kfree(thread);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
+ *
+ * If the thread comes from the cache it already has a stack.
  */
 static
 struct thread *
@@ -123,14 +183,18 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = thread_cache_get();
 	if (thread == NULL) {
-		return NULL;
+		thread = kmalloc(sizeof(*thread));
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		thread_cache_put(thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -139,10 +203,16 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_schedlevel = 0;
+	thread->t_schedticks = 0;
+	thread->t_lastcpu = NULL;
+	thread->t_lastrun = 0;
+	thread->t_affinity = NULL;
+	thread->t_deadline = 0;
+	thread->t_timernext = NULL;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -168,6 +238,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -179,11 +250,17 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
+	c->c_lastboost = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	c->c_loadavg = 0;
+	spinlock_init_ticket(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -213,7 +290,7 @@ cpu_create(unsigned hardware_number)
 		 */
 		/*c->c_curthread->t_stack = ... */
 	}
-	else {
+	else if (c->c_curthread->t_stack == NULL) {
 		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
@@ -249,9 +326,6 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -259,7 +333,10 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	thread->t_name = NULL;
+
+	/* Keep the thread and its stack for reuse, or free them */
+	thread_cache_put(thread);
 }
 
 /*
@@ -289,6 +366,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +382,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +508,322 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Scheduling priorities.
+ *
+ * The scheduler is a multi-level feedback queue. Threads start at level 0,
+ * the highest priority. A thread that keeps getting preempted by the
+ * timer has used up SCHED_ALLOTMENT(level) hardclocks at its level
+ * and is moved down one; a thread that sleeps and is woken up (that
+ * is, one waiting for I/O or for other threads) is moved up one. So
+ * CPU-bound threads sink and interactive ones float, and an
+ * interactive thread runs ahead of the hogs as soon as it wakes.
+ *
+ * So that the bottom levels don't starve, every
+ * SCHED_BOOST_HARDCLOCKS everything on the run queue is moved back
+ * to level 0.
+ */
+
+/* Hardclocks a thread may use at LEVEL before it's moved down. */
+#define SCHED_ALLOTMENT(level)	(2U << (level))
+
+/* Hardclocks between priority boosts (once a second). */
+#define SCHED_BOOST_HARDCLOCKS	HZ
+
+/* A thread that ran within this many hardclocks is cache-hot. */
+#define SCHED_HOT_HARDCLOCKS	2
+
+/*
+ * Charge thread T for a timeslice. Called from thread_switch when the
+ * timer preempts T.
+ */
+static
+void
+thread_sched_charge(struct thread *t)
+{
+	t->t_schedticks++;
+	if (t->t_schedticks >= SCHED_ALLOTMENT(t->t_schedlevel)) {
+		if (t->t_schedlevel < SCHED_NLEVELS - 1) {
+			t->t_schedlevel++;
+		}
+		t->t_schedticks = 0;
+	}
+}
+
+/*
+ * Give thread T, which has been asleep and is about to be made
+ * runnable, a higher priority. Called from the wchan wakeup
+ * functions; T is on no list at this point so nobody else can be
+ * looking at it.
+ */
+static
+void
+thread_sched_wakeup(struct thread *t)
+{
+	if (t->t_schedlevel > 0) {
+		t->t_schedlevel--;
+	}
+	t->t_schedticks = 0;
+}
+
+/*
+ * Run queue handling.
+ *
+ * Each cpu has one run queue per scheduling level. The next thread
+ * to run is taken from the highest-priority (lowest-numbered) level
+ * that has anything on it; threads at the same level run round-robin.
+ * The caller must hold the cpu's run queue lock.
+ */
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_schedlevel < SCHED_NLEVELS);
+
+	threadlist_addtail(&c->c_runqueue[t->t_schedlevel], t);
+	c->c_runcount++;
+}
+
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take the last thread from the lowest-priority level. This is the
+ * one that would run last, so it's the best one to move elsewhere.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Check if thread T, on cpu C's run queue, ran on C recently enough
+ * that it probably still has state in C's cache, or asked to run on
+ * C, in which case we'd rather not move it.
+ */
+static
+bool
+thread_cachehot(struct cpu *c, struct thread *t)
+{
+	if (t->t_affinity == c) {
+		return true;
+	}
+	return t->t_lastcpu == c &&
+		c->c_hardclocks - t->t_lastrun < SCHED_HOT_HARDCLOCKS;
+}
+
+/*
+ * Like runqueue_remtail, but skip threads that are cache-hot on C,
+ * or if HOTOK is set, only those that asked to run on C. Returns
+ * NULL if there aren't any others.
+ */
+static
+struct thread *
+runqueue_remcold(struct cpu *c, bool hotok)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue[i]) {
+			if (hotok ? t->t_affinity != c :
+			    !thread_cachehot(c, t)) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				c->c_runcount--;
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Load of cpu C, for placement decisions: the decayed average plus
+ * what's on it right now, so that a burst of new threads doesn't all
+ * land on the same cpu before the average catches up. Read without
+ * locking; it's only a hint.
+ */
+static
+unsigned
+cpu_load(struct cpu *c)
+{
+	unsigned now;
+
+	now = c->c_runcount + (c->c_isidle ? 0 : 1);
+	return c->c_loadavg + (now << SCHED_LOADSHIFT);
+}
+
+/*
+ * Choose a cpu for a new thread: the least loaded one, preferring
+ * the current cpu on ties since the new thread shares (at least) its
+ * parent's process with whatever is running here.
+ *
+ * If the thread has an affinity hint, use that cpu instead unless
+ * its load is more than one thread above the least loaded one's.
+ */
+static
+struct cpu *
+thread_place(struct cpu *hint)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus, load, bestload;
+
+	best = curcpu->c_self;
+	bestload = cpu_load(best);
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		load = cpu_load(c);
+		if (load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	if (hint != NULL &&
+	    cpu_load(hint) <= bestload + (1U << SCHED_LOADSHIFT)) {
+		return hint;
+	}
+	return best;
+}
+
+/*
+ * Work stealing.
+ *
+ * A cpu that runs out of threads takes one from the run queue of the
+ * busiest other cpu before it goes idle, and a cpu that gets handed
+ * work while it's busy pokes an idle cpu so it can come and take it.
+ * This gets new and newly woken threads running right away rather
+ * than waiting for thread_consider_migration.
+ *
+ * The other cpus' run queue counts and idle flags are read without
+ * locking. They're only hints; stealing rechecks under the lock.
+ */
+
+/*
+ * If some other cpu is idle, interrupt it so it will look for work
+ * to steal. BUSY is the cpu that just got a thread and is not idle.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Take a runnable thread from the cpu with the most waiting threads.
+ * Returns NULL if there's nothing to take. The thread is assigned to
+ * the current cpu but is not on any run queue.
+ *
+ * Called from thread_switch when about to idle, with interrupts off.
+ * We must not be holding our own run queue lock; otherwise two cpus
+ * stealing from each other could deadlock.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			/* An idle cpu will run its own threads shortly */
+			continue;
+		}
+		if (c->c_runcount > most) {
+			most = c->c_runcount;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	if (victim->c_isidle) {
+		/* It went idle while we were looking; leave it alone */
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+	/*
+	 * Take the thread that would otherwise run last there,
+	 * skipping ones that are cache-hot if possible. If they all
+	 * are, take one anyway; running it here now is better than
+	 * leaving this cpu idle. But never one that asked to run
+	 * there.
+	 */
+	t = runqueue_remcold(victim, false);
+	if (t == NULL) {
+		t = runqueue_remcold(victim, true);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		return NULL;
+	}
+
+	/*
+	 * A busy cpu's curthread is never on its run queue (see the
+	 * comments in thread_consider_migration), so T isn't running.
+	 */
+	t->t_cpu = curcpu->c_self;
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return t;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -447,10 +845,26 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		if (target->t_state == S_SLEEP &&
+		    target->t_affinity != NULL &&
+		    target->t_affinity != targetcpu) {
+			/*
+			 * It's waking up and would rather be on
+			 * another cpu. It went to sleep holding this
+			 * run queue lock, and the lock isn't let go
+			 * until it's completely switched out, so now
+			 * that we have it the thread is off its old
+			 * cpu and can be sent anywhere.
+			 */
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = target->t_affinity;
+			target->t_cpu = targetcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,6 +872,10 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else {
+		/* Let an idle cpu steal it, if there is one */
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -471,8 +889,8 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It will start on the least
+ * loaded CPU, which is often the same CPU as the caller.
  */
 int
 thread_fork(const char *name,
@@ -492,20 +910,23 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless we got a cached one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	newthread->t_cpu = thread_place(newthread->t_affinity);
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -528,7 +949,7 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the chosen cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
@@ -573,8 +994,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
+	/*
+	 * If the timer is preempting us, we used up a timeslice;
+	 * charge for it.
+	 */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		thread_sched_charge(cur);
+	}
+
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -611,12 +1040,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastrun = curcpu->c_hardclocks;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
-	 * curcpu->c_isidle must be true when md_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
+	 * Get the next thread. While there isn't one, try to steal one
+	 * from another cpu, and if that doesn't work, call cpu_idle().
+	 * curcpu->c_isidle must be true when cpu_idle is
+	 * called. Unlock the runqueue while idling (and stealing) too,
+	 * to make sure things can be added to it.
 	 *
 	 * Note that we don't need to unlock the runqueue atomically
 	 * with idling; becoming unidle requires receiving an
@@ -632,10 +1064,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -822,17 +1257,86 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is called periodically from hardclock(). It updates this
+ * cpu's load average and does the periodic priority boost described
+ * above the run queue code.
+ *
+ * The load average decays by 1/8 each call, so it follows the load
+ * over the last few dozen hardclocks.
  */
-
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i, load;
+
+	load = curcpu->c_runcount + (curcpu->c_isidle ? 0 : 1);
+	curcpu->c_loadavg -= curcpu->c_loadavg >> 3;
+	curcpu->c_loadavg += (load << SCHED_LOADSHIFT) >> 3;
+
+	if (curcpu->c_hardclocks - curcpu->c_lastboost <
+	    SCHED_BOOST_HARDCLOCKS) {
+		return;
+	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			t->t_schedlevel = 0;
+			t->t_schedticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	curthread->t_schedlevel = 0;
+	curthread->t_schedticks = 0;
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Check if T is on cpu C right now.
+ *
+ * A cpu that's idle keeps its last thread as c_curthread, so check
+ * c_isidle too. Both are read without the run queue lock; this is
+ * only a hint.
+ */
+bool
+thread_isrunning_on(struct cpu *c, struct thread *t)
+{
+	return !c->c_isidle && c->c_curthread == t;
+}
+
+/*
+ * Set the current thread's affinity hint. (See thread.h.)
+ *
+ * A running thread can't be moved to another cpu; its own cpu is
+ * still using its stack. A sleeping one can, when it's woken up (see
+ * thread_make_runnable). So if we're in the wrong place, nap for a
+ * tick and let the wakeup move us.
+ */
+void
+thread_setaffinity(struct cpu *c)
+{
+	KASSERT(curthread->t_in_interrupt == false);
+
+	curthread->t_affinity = c;
+	if (c != NULL && c != curcpu->c_self) {
+		clocknap(1);
+		KASSERT(curcpu->c_self == c);
+	}
+}
+
+/*
+ * Look up a cpu by number. (See thread.h.)
+ */
+struct cpu *
+thread_getcpu(unsigned num)
+{
+	if (num >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, num);
 }
 
 /*
@@ -848,9 +1352,9 @@ schedule(void)
  * and the performance loss due to underutilization of some CPUs is
  * something that needs to be tuned and probably is workload-specific.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Since idle cpus steal work for themselves, this is only for
+ * evening out cpus that are all busy, and isn't urgent; so we only
+ * move threads that aren't cache-hot.
  */
 void
 thread_consider_migration(void)
@@ -861,16 +1365,19 @@ thread_consider_migration(void)
 	struct threadlist victims;
 	struct thread *t;
 
+	/*
+	 * Count without locking; the counts can change as soon as we
+	 * let go of the locks anyway, and idle cpus steal work
+	 * themselves, so this only needs to be roughly right.
+	 */
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_runcount;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runcount;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -882,7 +1389,12 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remcold(curcpu, false);
+		if (t == NULL) {
+			/* Lost some to stealing, or the rest are hot */
+			to_send = i;
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -893,7 +1405,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_runcount < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -924,7 +1436,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1460,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1033,6 +1545,15 @@ wchan_sleep(struct wchan *wc)
  */
 void
 wchan_wakeone(struct wchan *wc)
+{
+	(void)wchan_wakeone_thread(wc);
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel, and say which.
+ */
+struct thread *
+wchan_wakeone_thread(struct wchan *wc)
 {
 	struct thread *target;
 
@@ -1047,10 +1568,28 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
+	thread_sched_wakeup(target);
 	thread_make_runnable(target, false);
+	return target;
+}
+
+/*
+ * Wake up the particular thread T, which must be asleep on WC, or on
+ * its way to sleep there holding the channel lock; in the latter
+ * case we wait for it to finish going to sleep.
+ */
+void
+wchan_wakethread(struct wchan *wc, struct thread *t)
+{
+	spinlock_acquire(&wc->wc_lock);
+	threadlist_remove(&wc->wc_threads, t);
+	spinlock_release(&wc->wc_lock);
+
+	thread_sched_wakeup(t);
+	thread_make_runnable(t, false);
 }
 
 /*
@@ -1084,6 +1623,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_sched_wakeup(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <poll.h>
 
 /*
  * Called for each open().
@@ -134,6 +135,22 @@ dev_ioctl(struct vnode *v, int op, userptr_t data)
 	return d->d_ioctl(d, op, data);
 }
 
+/*
+ * Called for poll(). Pass through, if the device cares.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollwait *pw, int *revents)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_poll == NULL) {
+		*revents = poll_alwaysready(events);
+		return 0;
+	}
+	return d->d_poll(d, events, pw, revents);
+}
+
 /*
  * Called for stat().
  * Set the type and the size (block devices only).
@@ -423,6 +440,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	null_io,      /* getdirentry */
 	dev_write,
 	dev_ioctl,
+	dev_poll,
 	dev_stat,
 	dev_gettype,
 	dev_tryseek,
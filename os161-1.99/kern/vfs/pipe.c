@@ -0,0 +1,915 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Pipes.
+ *
+ * The data lives in a page-sized ring buffer indexed by two free
+ * running counters: pp_wpos counts bytes ever written and pp_rpos
+ * bytes ever read. Only the (single) writer moves pp_wpos and only
+ * the (single) reader moves pp_rpos, so moving data needs no lock at
+ * all; pp_rlock and pp_wlock make sure there is only one of each at a
+ * time. The counters are unsigned and PIPE_SIZE is a power of two, so
+ * wraparound is harmless.
+ *
+ * pp_lock is only taken to go to sleep, to wake someone up, and to
+ * change the open/reference counts. A reader that finds the buffer
+ * empty sets pp_rwait and sleeps on pp_rwchan; a writer that finds it
+ * full sets pp_wwait and sleeps on pp_wwchan. The other side only
+ * looks at the flag without the lock, and the flag is cleared by
+ * whoever does the wakeup, so wakeups are batched: a writer wakes a
+ * sleeping reader once, after it is done writing or when it has
+ * filled the buffer, not once per chunk, and pays nothing at all when
+ * the reader isn't waiting. (This depends on the sleeper setting its
+ * flag before checking the counters, and the other side moving its
+ * counter before checking the flag. System/161 memory is sequentially
+ * consistent, so that is enough to avoid lost wakeups.)
+ *
+ * Pollers get the same batching: they are woken at the same points,
+ * and pollqueue_wakeup costs nothing when nobody is polling.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <uio.h>
+#include <vm.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+#define PIPE_SIZE	PAGE_SIZE	/* must be a power of 2 */
+
+/* Which sides an end (or an open of a FIFO) is */
+#define PIPE_READ	1
+#define PIPE_WRITE	2
+
+struct pipe {
+	char *pp_buf;			/* PIPE_SIZE ring buffer */
+	volatile unsigned pp_rpos;	/* bytes read; moved by reader */
+	volatile unsigned pp_wpos;	/* bytes written; moved by writer */
+
+	struct lock *pp_rlock;		/* one reader at a time */
+	struct lock *pp_wlock;		/* one writer at a time */
+
+	struct spinlock pp_lock;	/* for everything below */
+	struct wchan *pp_rwchan;	/* readers waiting for data/writers */
+	struct wchan *pp_wwchan;	/* writers waiting for space/readers */
+	volatile bool pp_rwait;		/* a reader wants waking */
+	volatile bool pp_wwait;		/* a writer wants waking */
+	volatile unsigned pp_readers;	/* open read sides */
+	volatile unsigned pp_writers;	/* open write sides */
+	unsigned pp_ropens;		/* read opens ever (for FIFOs) */
+	unsigned pp_wopens;		/* write opens ever (for FIFOs) */
+	unsigned pp_refs;		/* end vnodes, plus 1 for a FIFO */
+
+	struct pollqueue pp_pollq;	/* pollers on either end */
+};
+
+/* One end of a pipe. */
+struct pipeend {
+	struct vnode pe_v;
+	struct pipe *pe_pipe;
+	unsigned pe_how;		/* PIPE_READ and/or PIPE_WRITE */
+};
+
+static const struct vnode_ops pipe_vnode_ops;
+
+////////////////////////////////////////////////////////////
+// The pipe object
+
+static
+struct pipe *
+pipe_alloc(void)
+{
+	struct pipe *pp;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return NULL;
+	}
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_buf == NULL) {
+		goto fail;
+	}
+	pp->pp_rlock = lock_create("pipe-r");
+	if (pp->pp_rlock == NULL) {
+		goto fail_buf;
+	}
+	pp->pp_wlock = lock_create("pipe-w");
+	if (pp->pp_wlock == NULL) {
+		goto fail_rlock;
+	}
+	pp->pp_rwchan = wchan_create("pipe-r");
+	if (pp->pp_rwchan == NULL) {
+		goto fail_wlock;
+	}
+	pp->pp_wwchan = wchan_create("pipe-w");
+	if (pp->pp_wwchan == NULL) {
+		goto fail_rwchan;
+	}
+	spinlock_init(&pp->pp_lock);
+	pollqueue_init(&pp->pp_pollq);
+	pp->pp_rpos = 0;
+	pp->pp_wpos = 0;
+	pp->pp_rwait = false;
+	pp->pp_wwait = false;
+	pp->pp_readers = 0;
+	pp->pp_writers = 0;
+	pp->pp_ropens = 0;
+	pp->pp_wopens = 0;
+	pp->pp_refs = 0;
+	return pp;
+
+ fail_rwchan:
+	wchan_destroy(pp->pp_rwchan);
+ fail_wlock:
+	lock_destroy(pp->pp_wlock);
+ fail_rlock:
+	lock_destroy(pp->pp_rlock);
+ fail_buf:
+	kfree(pp->pp_buf);
+ fail:
+	kfree(pp);
+	return NULL;
+}
+
+static
+void
+pipe_free(struct pipe *pp)
+{
+	KASSERT(pp->pp_refs == 0);
+	KASSERT(pp->pp_readers == 0);
+	KASSERT(pp->pp_writers == 0);
+
+	pollqueue_cleanup(&pp->pp_pollq);
+	spinlock_cleanup(&pp->pp_lock);
+	wchan_destroy(pp->pp_wwchan);
+	wchan_destroy(pp->pp_rwchan);
+	lock_destroy(pp->pp_wlock);
+	lock_destroy(pp->pp_rlock);
+	kfree(pp->pp_buf);
+	kfree(pp);
+}
+
+/*
+ * Wake up whoever is sleeping on WC, if WAITING says anyone is. The
+ * unlocked check is what makes this nearly free in the common case.
+ */
+static
+void
+pipe_wakeup(struct pipe *pp, volatile bool *waiting, struct wchan *wc)
+{
+	if (!*waiting) {
+		return;
+	}
+	spinlock_acquire(&pp->pp_lock);
+	if (*waiting) {
+		*waiting = false;
+		wchan_wakeall(wc);
+	}
+	spinlock_release(&pp->pp_lock);
+}
+
+/*
+ * Sleep on WC. Call with pp_lock held; it is held again on return.
+ */
+static
+void
+pipe_sleep(struct pipe *pp, struct wchan *wc)
+{
+	KASSERT(spinlock_do_i_hold(&pp->pp_lock));
+	wchan_lock(wc);
+	spinlock_release(&pp->pp_lock);
+	wchan_sleep(wc);
+	spinlock_acquire(&pp->pp_lock);
+}
+
+/*
+ * Register an opener for the sides in HOW. If WAIT is set (FIFOs
+ * opened for only one side), wait until the other side has been
+ * opened too. Waiting on the opens counter rather than the current
+ * count means an opener that comes and goes again still lets us go.
+ */
+static
+void
+pipe_attach(struct pipe *pp, unsigned how, bool wait)
+{
+	unsigned gen;
+
+	spinlock_acquire(&pp->pp_lock);
+	if (how & PIPE_READ) {
+		pp->pp_readers++;
+		pp->pp_ropens++;
+		pp->pp_wwait = false;
+		wchan_wakeall(pp->pp_wwchan);
+	}
+	if (how & PIPE_WRITE) {
+		pp->pp_writers++;
+		pp->pp_wopens++;
+		pp->pp_rwait = false;
+		wchan_wakeall(pp->pp_rwchan);
+	}
+	if (wait && how == PIPE_READ) {
+		gen = pp->pp_wopens;
+		while (pp->pp_writers == 0 && pp->pp_wopens == gen) {
+			pipe_sleep(pp, pp->pp_rwchan);
+		}
+	}
+	else if (wait && how == PIPE_WRITE) {
+		gen = pp->pp_ropens;
+		while (pp->pp_readers == 0 && pp->pp_ropens == gen) {
+			pipe_sleep(pp, pp->pp_wwchan);
+		}
+	}
+	spinlock_release(&pp->pp_lock);
+	pollqueue_wakeup(&pp->pp_pollq);
+}
+
+/*
+ * Drop the sides in HOW, and wake up the other side so it notices
+ * EOF or a broken pipe.
+ */
+static
+void
+pipe_detach(struct pipe *pp, unsigned how)
+{
+	spinlock_acquire(&pp->pp_lock);
+	if (how & PIPE_READ) {
+		KASSERT(pp->pp_readers > 0);
+		pp->pp_readers--;
+		pp->pp_wwait = false;
+		wchan_wakeall(pp->pp_wwchan);
+	}
+	if (how & PIPE_WRITE) {
+		KASSERT(pp->pp_writers > 0);
+		pp->pp_writers--;
+		pp->pp_rwait = false;
+		wchan_wakeall(pp->pp_rwchan);
+	}
+	spinlock_release(&pp->pp_lock);
+	pollqueue_wakeup(&pp->pp_pollq);
+}
+
+/*
+ * Drop a reference to the pipe, freeing it with the last one.
+ */
+static
+void
+pipe_decref(struct pipe *pp)
+{
+	bool last;
+
+	spinlock_acquire(&pp->pp_lock);
+	KASSERT(pp->pp_refs > 0);
+	pp->pp_refs--;
+	last = (pp->pp_refs == 0);
+	spinlock_release(&pp->pp_lock);
+
+	if (last) {
+		pipe_free(pp);
+	}
+}
+
+/*
+ * Move LEN bytes between the ring buffer, starting at stream position
+ * POS, and UIO. Returns the number of bytes actually moved in *DONE,
+ * which is short only on error.
+ */
+static
+int
+pipe_move(struct pipe *pp, unsigned pos, size_t len, struct uio *uio,
+	  size_t *done)
+{
+	size_t off, n, startresid;
+	int result;
+
+	startresid = uio->uio_resid;
+	off = pos & (PIPE_SIZE - 1);
+	n = len;
+	if (n > PIPE_SIZE - off) {
+		n = PIPE_SIZE - off;
+	}
+
+	result = uiomove(pp->pp_buf + off, n, uio);
+	if (result == 0 && n < len) {
+		result = uiomove(pp->pp_buf, len - n, uio);
+	}
+	*done = startresid - uio->uio_resid;
+	return result;
+}
+
+/*
+ * Read. Waits only if the pipe is empty and we haven't got anything
+ * yet; returns 0 bytes (EOF) if it is empty with no writers left.
+ */
+static
+int
+pipe_read(struct pipe *pp, struct uio *uio)
+{
+	unsigned avail;
+	size_t len, done;
+	bool gotsome;
+	int result = 0;
+
+	lock_acquire(pp->pp_rlock);
+	gotsome = false;
+	while (uio->uio_resid > 0) {
+		avail = pp->pp_wpos - pp->pp_rpos;
+		if (avail == 0) {
+			if (gotsome) {
+				break;
+			}
+			spinlock_acquire(&pp->pp_lock);
+			while (1) {
+				pp->pp_rwait = true;
+				if (pp->pp_wpos != pp->pp_rpos ||
+				    pp->pp_writers == 0) {
+					break;
+				}
+				pipe_sleep(pp, pp->pp_rwchan);
+			}
+			pp->pp_rwait = false;
+			avail = pp->pp_wpos - pp->pp_rpos;
+			spinlock_release(&pp->pp_lock);
+			if (avail == 0) {
+				/* EOF */
+				break;
+			}
+		}
+
+		len = avail;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = pipe_move(pp, pp->pp_rpos, len, uio, &done);
+		pp->pp_rpos += done;
+		if (result) {
+			break;
+		}
+		gotsome = true;
+	}
+	pipe_wakeup(pp, &pp->pp_wwait, pp->pp_wwchan);
+	pollqueue_wakeup(&pp->pp_pollq);
+	lock_release(pp->pp_rlock);
+	return result;
+}
+
+/*
+ * Write. Waits for space as needed until everything is written. If
+ * the readers all go away, fails with EPIPE, unless some data was
+ * already written, in which case that is a short write.
+ */
+static
+int
+pipe_write(struct pipe *pp, struct uio *uio)
+{
+	unsigned space;
+	size_t len, done, startresid;
+	int result = 0;
+
+	lock_acquire(pp->pp_wlock);
+	startresid = uio->uio_resid;
+	while (uio->uio_resid > 0) {
+		if (pp->pp_readers == 0) {
+			result = EPIPE;
+			break;
+		}
+		space = PIPE_SIZE - (pp->pp_wpos - pp->pp_rpos);
+		if (space == 0) {
+			/* Buffer full: now is the time to wake the reader. */
+			pipe_wakeup(pp, &pp->pp_rwait, pp->pp_rwchan);
+			pollqueue_wakeup(&pp->pp_pollq);
+
+			spinlock_acquire(&pp->pp_lock);
+			while (1) {
+				pp->pp_wwait = true;
+				if (pp->pp_wpos - pp->pp_rpos < PIPE_SIZE ||
+				    pp->pp_readers == 0) {
+					break;
+				}
+				pipe_sleep(pp, pp->pp_wwchan);
+			}
+			pp->pp_wwait = false;
+			spinlock_release(&pp->pp_lock);
+			continue;
+		}
+
+		len = space;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = pipe_move(pp, pp->pp_wpos, len, uio, &done);
+		pp->pp_wpos += done;
+		if (result) {
+			break;
+		}
+	}
+	pipe_wakeup(pp, &pp->pp_rwait, pp->pp_rwchan);
+	pollqueue_wakeup(&pp->pp_pollq);
+	lock_release(pp->pp_wlock);
+
+	if (result == EPIPE && uio->uio_resid < startresid) {
+		result = 0;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Vnode operations
+
+/*
+ * Called on each open. Only FIFO vnodes come through here: each one
+ * is handed out fresh by pipe_fifovnode and opened exactly once, and
+ * this is where it learns which end it is.
+ */
+static
+int
+pipe_open(struct vnode *v, int openflags)
+{
+	struct pipeend *pe = v->vn_data;
+	unsigned how;
+
+	if (openflags & (O_CREAT | O_TRUNC | O_EXCL | O_APPEND)) {
+		return EINVAL;
+	}
+	if (pe->pe_how != 0) {
+		/* Anonymous pipe end; already open. */
+		return EINVAL;
+	}
+
+	switch (openflags & O_ACCMODE) {
+	    case O_RDONLY: how = PIPE_READ; break;
+	    case O_WRONLY: how = PIPE_WRITE; break;
+	    case O_RDWR: how = PIPE_READ | PIPE_WRITE; break;
+	    default: return EINVAL;
+	}
+
+	pe->pe_how = how;
+	pipe_attach(pe->pe_pipe, how, how != (PIPE_READ | PIPE_WRITE));
+	return 0;
+}
+
+/*
+ * Called on the last close of this end.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipeend *pe = v->vn_data;
+
+	pipe_detach(pe->pe_pipe, pe->pe_how);
+	pe->pe_how = 0;
+	return 0;
+}
+
+/*
+ * Called when the last reference goes away. Nothing can find a pipe
+ * end except through an existing reference, so nobody can have picked
+ * it up in the meantime.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipeend *pe = v->vn_data;
+	struct pipe *pp = pe->pe_pipe;
+
+	if (pe->pe_how != 0) {
+		/* Never properly closed */
+		pipe_detach(pp, pe->pe_how);
+	}
+	VOP_CLEANUP(&pe->pe_v);
+	kfree(pe);
+	pipe_decref(pp);
+	return 0;
+}
+
+static
+int
+pipe_vop_read(struct vnode *v, struct uio *uio)
+{
+	struct pipeend *pe = v->vn_data;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	if ((pe->pe_how & PIPE_READ) == 0) {
+		return EBADF;
+	}
+	return pipe_read(pe->pe_pipe, uio);
+}
+
+static
+int
+pipe_vop_write(struct vnode *v, struct uio *uio)
+{
+	struct pipeend *pe = v->vn_data;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	if ((pe->pe_how & PIPE_WRITE) == 0) {
+		return EBADF;
+	}
+	return pipe_write(pe->pe_pipe, uio);
+}
+
+/*
+ * poll: the read side is ready if there is data, and hung up if
+ * there are no writers; the write side is ready if there is space,
+ * and gets an error if there are no readers.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollwait *pw, int *revents)
+{
+	struct pipeend *pe = v->vn_data;
+	struct pipe *pp = pe->pe_pipe;
+	unsigned used;
+	int result;
+
+	if (pw != NULL) {
+		result = pollwait_register(pw, &pp->pp_pollq);
+		if (result) {
+			return result;
+		}
+	}
+
+	*revents = 0;
+	used = pp->pp_wpos - pp->pp_rpos;
+	if (pe->pe_how & PIPE_READ) {
+		if (used > 0) {
+			*revents |= events & (POLLIN | POLLRDNORM);
+		}
+		if (pp->pp_writers == 0) {
+			*revents |= POLLHUP;
+		}
+	}
+	if (pe->pe_how & PIPE_WRITE) {
+		if (used < PIPE_SIZE) {
+			*revents |= events & (POLLOUT | POLLWRNORM);
+		}
+		if (pp->pp_readers == 0) {
+			*revents |= POLLERR;
+		}
+	}
+	return 0;
+}
+
+/*
+ * stat: report the amount of data currently buffered as the size.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipeend *pe = v->vn_data;
+	struct pipe *pp = pe->pe_pipe;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_size = pp->pp_wpos - pp->pp_rpos;
+	statbuf->st_blksize = PIPE_SIZE;
+	statbuf->st_nlink = 1;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return ENODEV;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * As for devices, the VFS layer supplies the "name:" of a FIFO;
+ * anonymous pipes have no name.
+ */
+static
+int
+pipe_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return 0;
+}
+
+static
+int
+pipe_io_notdir(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+/*
+ * "fifo:" looks up to the FIFO itself; anything further is an error.
+ */
+static
+int
+pipe_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	if (strlen(pathname) > 0) {
+		return ENOTDIR;
+	}
+	VOP_INCREF(dir);
+	*result = dir;
+	return 0;
+}
+
+static
+int
+pipe_lookparent(struct vnode *dir, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_vop_read,
+	pipe_io_notdir,	/* readlink */
+	pipe_io_notdir,	/* getdirentry */
+	pipe_vop_write,
+	pipe_ioctl,
+	pipe_poll,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_namefile,
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+////////////////////////////////////////////////////////////
+// Creation
+
+/*
+ * Make a new end vnode for PP. It starts out as neither side; the
+ * caller or pipe_open decides. Takes a reference to PP.
+ */
+static
+int
+pipe_makeend(struct pipe *pp, struct pipeend **ret)
+{
+	struct pipeend *pe;
+	int result;
+
+	pe = kmalloc(sizeof(*pe));
+	if (pe == NULL) {
+		return ENOMEM;
+	}
+	result = VOP_INIT(&pe->pe_v, &pipe_vnode_ops, NULL, pe);
+	if (result) {
+		kfree(pe);
+		return result;
+	}
+	pe->pe_pipe = pp;
+	pe->pe_how = 0;
+
+	spinlock_acquire(&pp->pp_lock);
+	pp->pp_refs++;
+	spinlock_release(&pp->pp_lock);
+
+	*ret = pe;
+	return 0;
+}
+
+/*
+ * Create an anonymous pipe.
+ */
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *pp;
+	struct pipeend *rpe, *wpe;
+	int result;
+
+	pp = pipe_alloc();
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+
+	result = pipe_makeend(pp, &rpe);
+	if (result) {
+		pipe_free(pp);
+		return result;
+	}
+	result = pipe_makeend(pp, &wpe);
+	if (result) {
+		/* drops the last reference to pp */
+		VOP_DECREF(&rpe->pe_v);
+		return result;
+	}
+
+	rpe->pe_how = PIPE_READ;
+	wpe->pe_how = PIPE_WRITE;
+	pipe_attach(pp, PIPE_READ, false);
+	pipe_attach(pp, PIPE_WRITE, false);
+	VOP_INCOPEN(&rpe->pe_v);
+	VOP_INCOPEN(&wpe->pe_v);
+
+	*readend = &rpe->pe_v;
+	*writeend = &wpe->pe_v;
+	return 0;
+}
+
+/*
+ * Create a FIFO. The caller holds the FIFO's own reference until it
+ * calls pipe_rmfifo.
+ */
+struct pipe *
+pipe_mkfifo(void)
+{
+	struct pipe *pp;
+
+	pp = pipe_alloc();
+	if (pp == NULL) {
+		return NULL;
+	}
+	pp->pp_refs = 1;
+	return pp;
+}
+
+/*
+ * Drop the FIFO's own reference.
+ */
+void
+pipe_rmfifo(struct pipe *pp)
+{
+	pipe_decref(pp);
+}
+
+/*
+ * Get a vnode for opening a FIFO.
+ */
+int
+pipe_fifovnode(struct pipe *pp, struct vnode **ret)
+{
+	struct pipeend *pe;
+	int result;
+
+	result = pipe_makeend(pp, &pe);
+	if (result) {
+		return result;
+	}
+	*ret = &pe->pe_v;
+	return 0;
+}
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <pipe.h>
 
 /*
  * Structure for a single named device.
@@ -80,6 +81,7 @@ struct knowndev {
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	struct pipe *kd_fifo;
 };
 
 DECLARRAY(knowndev);
@@ -109,6 +111,8 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	vfs_ncache_bootstrap();
+
 	devnull_create();
 }
 
@@ -211,6 +215,17 @@ vfs_getroot(const char *devname, struct vnode **result)
 			}
 		}
 
+		/*
+		 * A FIFO hands out a fresh vnode for each open, so
+		 * that each open can be a separate reader or writer.
+		 */
+		if (kd->kd_fifo != NULL) {
+			if (!strcmp(kd->kd_name, devname)) {
+				return pipe_fifovnode(kd->kd_fifo, result);
+			}
+			continue;
+		}
+
 		/*
 		 * If DEVNAME names the device, and we get here, it
 		 * must have no fs and not be mountable. In this case,
@@ -406,6 +421,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_fifo = NULL;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
@@ -455,6 +471,56 @@ vfs_adddev(const char *devname, struct device *dev, int mountable)
 	return vfs_doadd(devname, mountable, dev, NULL);
 }
 
+/*
+ * Create a named FIFO. Like a device, it is accessed as "NAME:" and
+ * lasts until shutdown.
+ */
+int
+vfs_mkfifo(const char *name)
+{
+	struct knowndev *kd;
+	struct pipe *fifo;
+	unsigned index;
+	int result;
+
+	kd = kmalloc(sizeof(struct knowndev));
+	if (kd == NULL) {
+		return ENOMEM;
+	}
+	kd->kd_name = kstrdup(name);
+	if (kd->kd_name == NULL) {
+		kfree(kd);
+		return ENOMEM;
+	}
+	fifo = pipe_mkfifo();
+	if (fifo == NULL) {
+		kfree(kd->kd_name);
+		kfree(kd);
+		return ENOMEM;
+	}
+	kd->kd_rawname = NULL;
+	kd->kd_device = NULL;
+	kd->kd_vnode = NULL;
+	kd->kd_fs = NULL;
+	kd->kd_fifo = fifo;
+
+	vfs_biglock_acquire();
+	if (badnames(kd->kd_name, NULL, NULL)) {
+		result = EEXIST;
+	}
+	else {
+		result = knowndevarray_add(knowndevs, kd, &index);
+	}
+	vfs_biglock_release();
+
+	if (result) {
+		pipe_rmfifo(fifo);
+		kfree(kd->kd_name);
+		kfree(kd);
+	}
+	return result;
+}
+
 /*
  * Add a filesystem that does not have an underlying device.
  * This is used for emufs, but might also be used for network
@@ -571,6 +637,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* Cached names hold references; let go of them first. */
+	vfs_ncache_purgefs(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -619,6 +688,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_ncache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -235,11 +235,11 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
+	/* The big lock covers only the device table */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -256,8 +256,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 	}
 
 	VOP_DECREF(startvn);
-
-	vfs_biglock_release();
 	return result;
 }
 
@@ -267,23 +265,21 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
+	/* The big lock covers only the device table */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	result = VOP_LOOKUP(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * VFS name cache.
+ *
+ * Maps (directory vnode, name) to the vnode the name refers to, or
+ * records that the name does not exist (a "negative" entry, with a
+ * null vnode). Filesystems opt in by consulting the cache from their
+ * lookup routine and by calling vfs_ncache_remove whenever they add
+ * or remove a directory entry.
+ *
+ * Each entry holds a reference to its directory and, if positive, to
+ * the named vnode, so the pointers used as keys stay valid. Entries
+ * are recycled in approximately least-recently-used order, by the
+ * second-chance (clock) algorithm. Everything here is protected by
+ * ncache_lock, a reader-writer lock: lookups, which are by far the
+ * most common operation, only need it for reading and can run in
+ * parallel. So a lookup doesn't reorder the LRU list; it just sets
+ * nc_used, which being a single word can safely be written by
+ * several readers at once. References are never dropped while
+ * holding the lock, since dropping the last one calls into the
+ * filesystem.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+
+#define NCACHE_SIZE      128	/* number of entries */
+#define NCACHE_HASHSIZE  64	/* number of hash buckets; power of 2 */
+#define NCACHE_NAMELEN   32	/* longer names are not cached */
+
+struct ncentry {
+	struct vnode *nc_dir;		/* directory; NULL if entry unused */
+	struct vnode *nc_vn;		/* named vnode; NULL if negative */
+	char nc_name[NCACHE_NAMELEN];	/* name within nc_dir */
+	volatile bool nc_used;		/* looked up since last recycle pass */
+	struct ncentry *nc_hashnext;	/* next entry in hash chain */
+	struct ncentry *nc_lruprev;	/* LRU list links */
+	struct ncentry *nc_lrunext;
+};
+
+static struct rwlock *ncache_lock;
+static struct ncentry ncache[NCACHE_SIZE];
+static struct ncentry *ncache_hash[NCACHE_HASHSIZE];
+
+/*
+ * All entries, used or not, are on the LRU list. Unused entries are
+ * kept at the head so they get picked first.
+ */
+static struct ncentry *ncache_lruhead;
+static struct ncentry *ncache_lrutail;
+
+static
+unsigned
+ncache_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h = (uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h & (NCACHE_HASHSIZE - 1);
+}
+
+static
+void
+ncache_lru_unlink(struct ncentry *e)
+{
+	if (e->nc_lruprev != NULL) {
+		e->nc_lruprev->nc_lrunext = e->nc_lrunext;
+	}
+	else {
+		ncache_lruhead = e->nc_lrunext;
+	}
+	if (e->nc_lrunext != NULL) {
+		e->nc_lrunext->nc_lruprev = e->nc_lruprev;
+	}
+	else {
+		ncache_lrutail = e->nc_lruprev;
+	}
+}
+
+/* Move an entry to the most-recently-used end of the list. */
+static
+void
+ncache_touch(struct ncentry *e)
+{
+	ncache_lru_unlink(e);
+	e->nc_lrunext = NULL;
+	e->nc_lruprev = ncache_lrutail;
+	if (ncache_lrutail != NULL) {
+		ncache_lrutail->nc_lrunext = e;
+	}
+	else {
+		ncache_lruhead = e;
+	}
+	ncache_lrutail = e;
+}
+
+static
+struct ncentry *
+ncache_find(struct vnode *dir, const char *name)
+{
+	struct ncentry *e;
+
+	for (e = ncache_hash[ncache_hashfunc(dir, name)]; e != NULL;
+	     e = e->nc_hashnext) {
+		if (e->nc_dir == dir && !strcmp(e->nc_name, name)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Invalidate an entry: take it out of its hash chain and move it to
+ * the head of the LRU list. The references it held are handed back
+ * in *DIRP and *VNP (which may be NULL) for the caller to drop with
+ * ncache_release once ncache_lock is no longer held.
+ */
+static
+void
+ncache_drop(struct ncentry *e, struct vnode **dirp, struct vnode **vnp)
+{
+	struct ncentry **pp;
+
+	KASSERT(rwlock_do_i_hold_write(ncache_lock));
+	KASSERT(e->nc_dir != NULL);
+
+	for (pp = &ncache_hash[ncache_hashfunc(e->nc_dir, e->nc_name)];
+	     *pp != e; pp = &(*pp)->nc_hashnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = e->nc_hashnext;
+	e->nc_hashnext = NULL;
+
+	*dirp = e->nc_dir;
+	*vnp = e->nc_vn;
+	e->nc_dir = NULL;
+	e->nc_vn = NULL;
+	e->nc_name[0] = 0;
+	e->nc_used = false;
+
+	ncache_lru_unlink(e);
+	e->nc_lruprev = NULL;
+	e->nc_lrunext = ncache_lruhead;
+	if (ncache_lruhead != NULL) {
+		ncache_lruhead->nc_lruprev = e;
+	}
+	else {
+		ncache_lrutail = e;
+	}
+	ncache_lruhead = e;
+}
+
+/*
+ * Drop the references ncache_drop handed back. This might reclaim
+ * the vnodes.
+ */
+static
+void
+ncache_release(struct vnode *dir, struct vnode *vn)
+{
+	KASSERT(!rwlock_do_i_hold_write(ncache_lock));
+
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+/*
+ * Setup function; called from vfs_bootstrap.
+ */
+void
+vfs_ncache_bootstrap(void)
+{
+	unsigned i;
+
+	ncache_lock = rwlock_create("ncache");
+	if (ncache_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+
+	for (i=0; i<NCACHE_HASHSIZE; i++) {
+		ncache_hash[i] = NULL;
+	}
+	for (i=0; i<NCACHE_SIZE; i++) {
+		ncache[i].nc_dir = NULL;
+		ncache[i].nc_vn = NULL;
+		ncache[i].nc_name[0] = 0;
+		ncache[i].nc_used = false;
+		ncache[i].nc_hashnext = NULL;
+		ncache[i].nc_lruprev = i > 0 ? &ncache[i-1] : NULL;
+		ncache[i].nc_lrunext = i+1 < NCACHE_SIZE ? &ncache[i+1] : NULL;
+	}
+	ncache_lruhead = &ncache[0];
+	ncache_lrutail = &ncache[NCACHE_SIZE-1];
+}
+
+/*
+ * Look up NAME in DIR. Returns false if the cache doesn't know.
+ * Otherwise returns true and sets *RET to the vnode (with a new
+ * reference), or to NULL if the name is known not to exist.
+ */
+bool
+vfs_ncache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct ncentry *e;
+
+	rwlock_acquire_read(ncache_lock);
+
+	e = ncache_find(dir, name);
+	if (e == NULL) {
+		rwlock_release_read(ncache_lock);
+		return false;
+	}
+
+	e->nc_used = true;
+	if (e->nc_vn != NULL) {
+		VOP_INCREF(e->nc_vn);
+	}
+	*ret = e->nc_vn;
+
+	rwlock_release_read(ncache_lock);
+	return true;
+}
+
+/*
+ * Record that NAME in DIR refers to VN, or, if VN is NULL, that
+ * there is no such name. Replaces any existing entry.
+ */
+void
+vfs_ncache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct ncentry *e;
+	struct vnode *olddir1 = NULL, *oldvn1 = NULL;
+	struct vnode *olddir2 = NULL, *oldvn2 = NULL;
+	unsigned h;
+
+	if (strlen(name) >= NCACHE_NAMELEN) {
+		return;
+	}
+
+	rwlock_acquire_write(ncache_lock);
+
+	e = ncache_find(dir, name);
+	if (e != NULL) {
+		ncache_drop(e, &olddir1, &oldvn1);
+	}
+
+	/*
+	 * Recycle the least recently used entry, giving entries that
+	 * have been looked up since they last came around a second
+	 * chance. This ends because each pass clears nc_used.
+	 */
+	e = ncache_lruhead;
+	while (e->nc_used) {
+		e->nc_used = false;
+		ncache_touch(e);
+		e = ncache_lruhead;
+	}
+	if (e->nc_dir != NULL) {
+		ncache_drop(e, &olddir2, &oldvn2);
+		KASSERT(ncache_lruhead == e);
+	}
+
+	VOP_INCREF(dir);
+	e->nc_dir = dir;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	e->nc_vn = vn;
+	strcpy(e->nc_name, name);
+
+	h = ncache_hashfunc(dir, name);
+	e->nc_hashnext = ncache_hash[h];
+	ncache_hash[h] = e;
+	ncache_touch(e);
+
+	rwlock_release_write(ncache_lock);
+
+	ncache_release(olddir1, oldvn1);
+	ncache_release(olddir2, oldvn2);
+}
+
+/*
+ * Forget whatever is known about NAME in DIR.
+ */
+void
+vfs_ncache_remove(struct vnode *dir, const char *name)
+{
+	struct ncentry *e;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	rwlock_acquire_write(ncache_lock);
+	e = ncache_find(dir, name);
+	if (e != NULL) {
+		ncache_drop(e, &olddir, &oldvn);
+	}
+	rwlock_release_write(ncache_lock);
+
+	ncache_release(olddir, oldvn);
+}
+
+/*
+ * Forget every entry belonging to filesystem FS. Called before
+ * unmounting so the cache's references don't keep FS busy.
+ */
+void
+vfs_ncache_purgefs(struct fs *fs)
+{
+	struct vnode *olddir, *oldvn;
+	unsigned i;
+
+	for (i=0; i<NCACHE_SIZE; i++) {
+		olddir = oldvn = NULL;
+
+		rwlock_acquire_write(ncache_lock);
+		if (ncache[i].nc_dir != NULL && ncache[i].nc_dir->vn_fs == fs) {
+			ncache_drop(&ncache[i], &olddir, &oldvn);
+		}
+		rwlock_release_write(ncache_lock);
+
+		ncache_release(olddir, oldvn);
+	}
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Poll support: pollqueues, which objects that can become ready
+ * keep, and pollwaits, which pollers sleep on. See poll.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <poll.h>
+#include <lamebus/ltimer.h>
+
+/*
+ * One registration of a pollwait on a pollqueue. It is on two lists:
+ * the queue's (protected by pq_lock) and the pollwait's (private to
+ * the polling thread).
+ */
+struct pollentry {
+	struct pollqueue *pe_queue;
+	struct pollwait *pe_wait;
+	struct pollentry *pe_qnext;	/* next on the queue */
+	struct pollentry **pe_qprevp;	/* what points at us on the queue */
+	struct pollentry *pe_wnext;	/* next for the same pollwait */
+};
+
+/*
+ * Pollwaits with a timeout. Run down by poll_timerclock.
+ */
+static struct spinlock poll_timedlock = SPINLOCK_INITIALIZER;
+static struct pollwait *poll_timed;
+
+////////////////////////////////////////////////////////////
+// pollqueue
+
+void
+pollqueue_init(struct pollqueue *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_entries = NULL;
+}
+
+void
+pollqueue_cleanup(struct pollqueue *pq)
+{
+	KASSERT(pq->pq_entries == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+/*
+ * Wake PW up, if it's asleep, and make sure it doesn't go to sleep
+ * again without rescanning.
+ */
+static
+void
+pollwait_wake(struct pollwait *pw, bool timeout)
+{
+	spinlock_acquire(&pw->pw_lock);
+	if (timeout) {
+		pw->pw_timedout = true;
+	}
+	else {
+		pw->pw_woken = true;
+	}
+	wchan_wakeall(pw->pw_wchan);
+	spinlock_release(&pw->pw_lock);
+}
+
+/*
+ * The object's state changed. The unlocked check keeps this cheap
+ * when nobody is polling; that is safe because pollers register
+ * before they look at the object's state, and the object changes its
+ * state before calling us.
+ */
+void
+pollqueue_wakeup(struct pollqueue *pq)
+{
+	struct pollentry *pe;
+
+	if (pq->pq_entries == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_entries; pe != NULL; pe = pe->pe_qnext) {
+		pollwait_wake(pe->pe_wait, false);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// pollwait
+
+int
+pollwait_init(struct pollwait *pw, int timeout)
+{
+	unsigned ticks;
+
+	pw->pw_wchan = wchan_create("poll");
+	if (pw->pw_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&pw->pw_lock);
+	pw->pw_woken = false;
+	pw->pw_timedout = false;
+	pw->pw_entries = NULL;
+	pw->pw_timednext = NULL;
+	pw->pw_ticks = -1;
+
+	if (timeout > 0) {
+		/*
+		 * Round up to whole timer ticks. Do it in 64 bits;
+		 * the timeout in microseconds can overflow 32.
+		 */
+		ticks = ((uint64_t)timeout * 1000 + LT_GRANULARITY - 1)
+			/ LT_GRANULARITY;
+		pw->pw_ticks = ticks;
+
+		spinlock_acquire(&poll_timedlock);
+		pw->pw_timednext = poll_timed;
+		poll_timed = pw;
+		spinlock_release(&poll_timedlock);
+	}
+	return 0;
+}
+
+int
+pollwait_register(struct pollwait *pw, struct pollqueue *pq)
+{
+	struct pollentry *pe;
+
+	pe = kmalloc(sizeof(*pe));
+	if (pe == NULL) {
+		return ENOMEM;
+	}
+	pe->pe_queue = pq;
+	pe->pe_wait = pw;
+
+	pe->pe_wnext = pw->pw_entries;
+	pw->pw_entries = pe;
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_qnext = pq->pq_entries;
+	if (pe->pe_qnext != NULL) {
+		pe->pe_qnext->pe_qprevp = &pe->pe_qnext;
+	}
+	pe->pe_qprevp = (struct pollentry **)&pq->pq_entries;
+	pq->pq_entries = pe;
+	spinlock_release(&pq->pq_lock);
+
+	return 0;
+}
+
+bool
+pollwait_sleep(struct pollwait *pw)
+{
+	bool timedout;
+
+	spinlock_acquire(&pw->pw_lock);
+	while (!pw->pw_woken && !pw->pw_timedout) {
+		wchan_lock(pw->pw_wchan);
+		spinlock_release(&pw->pw_lock);
+		wchan_sleep(pw->pw_wchan);
+		spinlock_acquire(&pw->pw_lock);
+	}
+	timedout = pw->pw_timedout && !pw->pw_woken;
+	pw->pw_woken = false;
+	spinlock_release(&pw->pw_lock);
+
+	return timedout;
+}
+
+void
+pollwait_cleanup(struct pollwait *pw)
+{
+	struct pollwait **pwp;
+	struct pollentry *pe;
+	struct pollqueue *pq;
+
+	if (pw->pw_ticks >= 0) {
+		spinlock_acquire(&poll_timedlock);
+		for (pwp = &poll_timed; *pwp != pw; pwp = &(*pwp)->pw_timednext) {
+			KASSERT(*pwp != NULL);
+		}
+		*pwp = pw->pw_timednext;
+		spinlock_release(&poll_timedlock);
+	}
+
+	while (pw->pw_entries != NULL) {
+		pe = pw->pw_entries;
+		pw->pw_entries = pe->pe_wnext;
+
+		pq = pe->pe_queue;
+		spinlock_acquire(&pq->pq_lock);
+		*pe->pe_qprevp = pe->pe_qnext;
+		if (pe->pe_qnext != NULL) {
+			pe->pe_qnext->pe_qprevp = pe->pe_qprevp;
+		}
+		spinlock_release(&pq->pq_lock);
+		kfree(pe);
+	}
+
+	spinlock_cleanup(&pw->pw_lock);
+	wchan_destroy(pw->pw_wchan);
+}
+
+////////////////////////////////////////////////////////////
+// misc
+
+int
+poll_alwaysready(int events)
+{
+	return events & (POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM);
+}
+
+/*
+ * Count down the timeouts. Called on one CPU every timer tick. Once
+ * expired, a pollwait stays on the list (with pw_ticks 0) until it
+ * is cleaned up.
+ */
+void
+poll_timerclock(void)
+{
+	struct pollwait *pw;
+
+	if (poll_timed == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&poll_timedlock);
+	for (pw = poll_timed; pw != NULL; pw = pw->pw_timednext) {
+		if (pw->pw_ticks > 0 && --pw->pw_ticks == 0) {
+			pollwait_wake(pw, true);
+		}
+	}
+	spinlock_release(&poll_timedlock);
+}
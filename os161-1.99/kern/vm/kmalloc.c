@@ -195,7 +195,7 @@ static struct pageref *allbase;
  * OS/161 performance and scalability aren't super-critical.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock = SPINLOCK_TICKET_INITIALIZER("kmalloc_spinlock");
 
 ////////////////////////////////////////
 
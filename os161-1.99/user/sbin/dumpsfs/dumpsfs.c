@@ -56,6 +56,8 @@
 
 #include "disk.h"
 
+static uint32_t jstart, jblocks;
+
 static
 uint32_t
 dumpsb(void)
@@ -69,12 +71,70 @@ dumpsb(void)
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
 
+	jstart = SWAPL(sp.sp_journalstart);
+	jblocks = SWAPL(sp.sp_journalblocks);
+
 	return SWAPL(sp.sp_nblocks);
 }
 
+/*
+ * Show the journal and the transactions in it that look complete
+ * (by descriptor and commit record; the checksum isn't verified).
+ */
+static
+void
+dumpjournal(void)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	struct sfs_jcommit jc;
+	uint32_t seq, off, n, i;
+
+	if (jblocks == 0) {
+		printf("Journal: none\n");
+		return;
+	}
+
+	diskread(&jh, jstart);
+	if (SWAPL(jh.jh_magic) != SFS_JMAGIC) {
+		printf("Journal: %u blocks at %u, bad header\n",
+		       jblocks, jstart);
+		return;
+	}
+	seq = SWAPL(jh.jh_seq);
+	printf("Journal: %u blocks at %u, first transaction %u\n",
+	       jblocks, jstart, seq);
+
+	for (off = 1; off + 2 <= jblocks; off += n + 2) {
+		diskread(&jd, jstart+off);
+		n = SWAPL(jd.jd_nblocks);
+		if (SWAPL(jd.jd_magic) != SFS_JDESC_MAGIC ||
+		    SWAPL(jd.jd_seq) != seq ||
+		    n == 0 || n > SFS_JMAXTX || off + n + 2 > jblocks) {
+			break;
+		}
+		diskread(&jc, jstart+off+1+n);
+		if (SWAPL(jc.jc_magic) != SFS_JCOMMIT_MAGIC ||
+		    SWAPL(jc.jc_seq) != seq) {
+			break;
+		}
+		printf("    [transaction %u: %u blocks]", seq, n);
+		for (i=0; i<n; i++) {
+			printf(" %u", SWAPL(jd.jd_blocks[i]));
+		}
+		printf("\n");
+		seq++;
+	}
+}
+
+/*
+ * Dump one block of a directory. FILEBLOCK is its position in the
+ * directory; in hashed directories the first NBUCKETS blocks are
+ * hash buckets and the rest is the overflow area.
+ */
 static
 void
-dodirblock(uint32_t block)
+dodirblock(uint32_t block, uint32_t fileblock, uint32_t nbuckets)
 {
 	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
 	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
@@ -82,7 +142,15 @@ dodirblock(uint32_t block)
 
 	diskread(&sds, block);
 
-	printf("    [block %u]\n", block);
+	if (nbuckets == 0) {
+		printf("    [block %u]\n", block);
+	}
+	else if (fileblock < nbuckets) {
+		printf("    [block %u: bucket %u]\n", block, fileblock);
+	}
+	else {
+		printf("    [block %u: overflow]\n", block);
+	}
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAPL(sds[i].sfd_ino);
 		if (ino==SFS_NOINO) {
@@ -95,14 +163,54 @@ dodirblock(uint32_t block)
 	}
 }
 
+/*
+ * Dump the directory blocks under indirect block IDBLOCK, which has
+ * LEVELS levels of indirection and maps file blocks from BASE on.
+ * Returns the number of directory blocks found.
+ */
+static
+uint32_t
+dodirindirect(uint32_t idblock, unsigned levels, uint32_t base,
+	      uint32_t nbuckets)
+{
+	uint32_t ib[SFS_DBPERIDB];
+	uint32_t span, block, nblocks=0;
+	unsigned i;
+
+	if (idblock == 0) {
+		return 0;
+	}
+
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	diskread(&ib, idblock);
+	for (i=0; i<SFS_DBPERIDB; i++) {
+		block = SWAPL(ib[i]);
+		if (block == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			nblocks += dodirindirect(block, levels-1,
+						 base + i*span, nbuckets);
+		}
+		else {
+			dodirblock(block, base+i, nbuckets);
+			nblocks++;
+		}
+	}
+	return nblocks;
+}
+
 static
 void
 dumpdir(uint32_t ino)
 {
 	struct sfs_inode sfi;
-	uint32_t ib[SFS_DBPERIDB];
 	int nentries, i;
-	uint32_t block, nblocks=0;
+	uint32_t block, base, nblocks=0, nbuckets;
 
 	diskread(&sfi, ino);
 
@@ -110,25 +218,28 @@ dumpdir(uint32_t ino)
 	if (SWAPL(sfi.sfi_size) % sizeof(struct sfs_dir) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
-	printf("Directory %u: %d entries\n", ino, nentries);
+	nbuckets = SWAPL(sfi.sfi_dirbuckets);
+	if (nbuckets != 0) {
+		printf("Directory %u: %d entries, hashed, %u buckets\n",
+		       ino, nentries, nbuckets);
+	}
+	else {
+		printf("Directory %u: %d entries\n", ino, nentries);
+	}
 
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = SWAPL(sfi.sfi_direct[i]);
 		if (block) {
-			dodirblock(block);
+			dodirblock(block, i, nbuckets);
 			nblocks++;
 		}
 	}
-	if (SWAPL(sfi.sfi_indirect)) {
-		diskread(&ib, SWAPL(sfi.sfi_indirect));
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			block = SWAPL(ib[i]);
-			if (block) {
-				dodirblock(block);
-				nblocks++;
-			}
-		}
-	}
+	base = SFS_NDIRECT;
+	nblocks += dodirindirect(SWAPL(sfi.sfi_indirect), 1, base, nbuckets);
+	base += SFS_DBPERIDB;
+	nblocks += dodirindirect(SWAPL(sfi.sfi_dindirect), 2, base, nbuckets);
+	base += SFS_DBPERIDB*SFS_DBPERIDB;
+	nblocks += dodirindirect(SWAPL(sfi.sfi_tindirect), 3, base, nbuckets);
 	printf("    %u blocks in directory\n", nblocks);
 }
 
@@ -169,6 +280,7 @@ main(int argc, char **argv)
 
 	opendisk(argv[1]);
 	nblocks = dumpsb();
+	dumpjournal();
 	dumpbits(nblocks);
 	dumpdir(SFS_ROOT_LOCATION);
 
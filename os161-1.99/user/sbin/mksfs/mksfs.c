@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -68,7 +69,8 @@ check(void)
 
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks,
+	   uint32_t jstart, uint32_t jblocks)
 {
 	struct sfs_super sp;
 
@@ -81,25 +83,72 @@ writesuper(const char *volname, uint32_t nblocks)
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
 	strcpy(sp.sp_volname, volname);
+	sp.sp_journalstart = SWAPL(jstart);
+	sp.sp_journalblocks = SWAPL(jblocks);
 
 	diskwrite(&sp, SFS_SB_LOCATION);
 }
 
+/*
+ * Write the root directory. If DIRBUCKETS is nonzero, make it a
+ * hashed directory with that many (empty) bucket blocks, which go
+ * in the blocks starting at FIRSTBLOCK. This is only the initial
+ * count; the kernel adds buckets as the directory grows.
+ */
 static
 void
-writerootdir(void)
+writerootdir(uint32_t dirbuckets, uint32_t firstblock)
 {
 	struct sfs_inode sfi;
+	char zeros[SFS_BLOCKSIZE];
+	uint32_t i;
 
 	bzero((void *)&sfi, sizeof(sfi));
+	bzero(zeros, sizeof(zeros));
+
+	assert(dirbuckets <= SFS_NDIRECT);
+	for (i=0; i<dirbuckets; i++) {
+		diskwrite(zeros, firstblock+i);
+		sfi.sfi_direct[i] = SWAPL(firstblock+i);
+	}
 
-	sfi.sfi_size = SWAPL(0);
+	sfi.sfi_size = SWAPL(dirbuckets*SFS_BLOCKSIZE);
 	sfi.sfi_type = SWAPS(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAPS(1);
+	sfi.sfi_dirbuckets = SWAPL(dirbuckets);
 
 	diskwrite(&sfi, SFS_ROOT_LOCATION);
 }
 
+/*
+ * Write an empty journal of JBLOCKS blocks at JSTART. The log blocks
+ * are zeroed so nothing left over from before looks like a
+ * transaction.
+ */
+static
+void
+writejournal(uint32_t jstart, uint32_t jblocks)
+{
+	struct sfs_jheader jh;
+	char zeros[SFS_BLOCKSIZE];
+	uint32_t i;
+
+	if (jblocks == 0) {
+		return;
+	}
+
+	bzero((void *)&jh, sizeof(jh));
+	bzero(zeros, sizeof(zeros));
+
+	jh.jh_magic = SWAPL(SFS_JMAGIC);
+	jh.jh_seq = SWAPL(1);
+	diskwrite(&jh, jstart);
+
+	for (i=1; i<jblocks; i++) {
+		diskwrite(zeros, jstart+i);
+	}
+}
+
 static char bitbuf[MAXBITBLOCKS*SFS_BLOCKSIZE];
 
 static
@@ -115,7 +164,7 @@ doallocbit(uint32_t bit)
 
 static
 void
-writebitmap(uint32_t fsblocks)
+writebitmap(uint32_t fsblocks, uint32_t dirbuckets, uint32_t jblocks)
 {
 
 	uint32_t nbits = SFS_BITMAPSIZE(fsblocks);
@@ -133,6 +182,14 @@ writebitmap(uint32_t fsblocks)
 	for (i=0; i<nblocks; i++) {
 		doallocbit(SFS_MAP_LOCATION+i);
 	}
+	/* root directory buckets come right after the bitmap */
+	for (i=0; i<dirbuckets; i++) {
+		doallocbit(SFS_MAP_LOCATION+nblocks+i);
+	}
+	/* and the journal after them */
+	for (i=0; i<jblocks; i++) {
+		doallocbit(SFS_MAP_LOCATION+nblocks+dirbuckets+i);
+	}
 	for (i=fsblocks; i<nbits; i++) {
 		doallocbit(i);
 	}
@@ -146,15 +203,41 @@ writebitmap(uint32_t fsblocks)
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, dirbuckets = 1;
+	uint32_t jstart, jblocks = SFS_JOURNALSIZE;
+	int jdefault = 1;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	while (argc>=5 && argv[1][0]=='-') {
+		if (!strcmp(argv[1], "-d")) {
+			dirbuckets = atoi(argv[2]);
+			if (dirbuckets > SFS_NDIRECT) {
+				errx(1, "Number of directory buckets must be "
+				     "between 0 and %u", SFS_NDIRECT);
+			}
+		}
+		else if (!strcmp(argv[1], "-j")) {
+			jblocks = atoi(argv[2]);
+			jdefault = 0;
+			if (jblocks != 0 && jblocks < SFS_JMINSIZE) {
+				errx(1, "Journal must be 0 (none) or at "
+				     "least %u blocks", SFS_JMINSIZE);
+			}
+		}
+		else {
+			break;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-d buckets] [-j journalblocks] "
+		     "device/diskfile volume-name");
 	}
 
 	check();
@@ -185,9 +268,29 @@ main(int argc, char **argv)
 	}
 	size = diskblocks();
 
-	writesuper(volname, size);
-	writerootdir();
-	writebitmap(size);
+	/*
+	 * Unless told otherwise, don't let the journal take more than
+	 * an eighth of the volume; leave it out on tiny volumes.
+	 */
+	if (jdefault && jblocks > size/8) {
+		jblocks = size/8;
+		if (jblocks < SFS_JMINSIZE) {
+			jblocks = 0;
+		}
+	}
+
+	jstart = SFS_MAP_LOCATION + SFS_BITBLOCKS(size) + dirbuckets;
+	if (jstart + jblocks > size) {
+		errx(1, "Device too small");
+	}
+	if (jblocks == 0) {
+		jstart = 0;
+	}
+
+	writesuper(volname, size, jstart, jblocks);
+	writerootdir(dirbuckets, SFS_MAP_LOCATION + SFS_BITBLOCKS(size));
+	writejournal(jstart, jblocks);
+	writebitmap(size, dirbuckets, jblocks);
 
 	closedisk();
 
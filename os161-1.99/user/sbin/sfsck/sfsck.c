@@ -83,6 +83,8 @@ swapsb(struct sfs_super *sp)
 {
 	sp->sp_magic = SWAPL(sp->sp_magic);
 	sp->sp_nblocks = SWAPL(sp->sp_nblocks);
+	sp->sp_journalstart = SWAPL(sp->sp_journalstart);
+	sp->sp_journalblocks = SWAPL(sp->sp_journalblocks);
 }
 
 static
@@ -107,6 +109,8 @@ swapinode(struct sfs_inode *sfi)
 	sfi->sfi_indirect = SWAPL(sfi->sfi_indirect);
 #endif
 
+	sfi->sfi_dirbuckets = SWAPL(sfi->sfi_dirbuckets);
+
 #ifdef SFS_NDIDIRECT
 	for (i=0; i<SFS_NDIDIRECT; i++) {
 		sfi->sfi_dindirect[i] = SWAPL(sfi->sfi_dindirect[i]);
@@ -172,6 +176,7 @@ domalloc(size_t len)
 typedef enum {
 	B_SUPERBLOCK,	/* Block that is the superblock */
 	B_BITBLOCK,	/* Block used by free-block bitmap */
+	B_JOURNAL,	/* Block used by the journal */
 	B_INODE,	/* Block that is an inode */
 	B_IBLOCK,	/* Indirect (or doubly-indirect etc.) block */
 	B_DIRDATA,	/* Data block of a directory */
@@ -181,6 +186,7 @@ typedef enum {
 } blockusage_t;
 
 static uint32_t nblocks, bitblocks;
+static uint32_t jstart, jblocks;
 static uint32_t uniquecounter = 1;
 
 static unsigned long count_blocks=0, count_dirs=0, count_files=0;
@@ -210,6 +216,7 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 	switch (how) {
 	    case B_SUPERBLOCK: return "superblock";
 	    case B_BITBLOCK: return "bitmap block";
+	    case B_JOURNAL: return "journal block";
 	    case B_INODE: return "inode";
 	    case B_IBLOCK: 
 		snprintf(rv, sizeof(rv), "indirect block of inode %lu", 
@@ -545,6 +552,21 @@ check_sb(void)
 		schanged = 1;
 	}
 
+	if (sp.sp_journalblocks != 0 &&
+	    (sp.sp_journalstart < SFS_MAP_LOCATION + bitblocks ||
+	     sp.sp_journalblocks < SFS_JMINSIZE ||
+	     sp.sp_journalstart + sp.sp_journalblocks > nblocks ||
+	     sp.sp_journalstart + sp.sp_journalblocks < sp.sp_journalstart)) {
+		warnx("Journal location %lu size %lu invalid "
+		      "(journal removed)", (unsigned long) sp.sp_journalstart,
+		      (unsigned long) sp.sp_journalblocks);
+		setbadness(EXIT_RECOV);
+		sp.sp_journalstart = sp.sp_journalblocks = 0;
+		schanged = 1;
+	}
+	jstart = sp.sp_journalstart;
+	jblocks = sp.sp_journalblocks;
+
 	if (schanged) {
 		swapsb(&sp);
 		diskwrite(&sp, SFS_SB_LOCATION);
@@ -554,6 +576,127 @@ check_sb(void)
 	for (i=0; i<bitblocks; i++) {
 		bitmap_mark(SFS_MAP_LOCATION+i, B_BITBLOCK, i);
 	}
+	for (i=0; i<jblocks; i++) {
+		bitmap_mark(jstart+i, B_JOURNAL, i);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Write the journal header, saying the log starts with transaction
+ * SEQ.
+ */
+static
+void
+writejheader(uint32_t seq)
+{
+	struct sfs_jheader jh;
+
+	bzero(&jh, sizeof(jh));
+	jh.jh_magic = SWAPL(SFS_JMAGIC);
+	jh.jh_seq = SWAPL(seq);
+	diskwrite(&jh, jstart);
+}
+
+/*
+ * Replay the journal: copy the blocks of each complete transaction
+ * to where they belong, stopping at the first one that isn't
+ * complete, and then mark the journal empty. This has to happen
+ * before anything else looks at the filesystem. The format is
+ * described in kern/sfs.h; the kernel does the same thing at mount.
+ */
+static
+void
+check_journal(void)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	struct sfs_jcommit jc;
+	uint32_t seq, off, n, sum, i, k, block;
+	uint32_t *images;
+	unsigned ntx = 0;
+	char zeros[SFS_BLOCKSIZE];
+
+	if (jblocks == 0) {
+		return;
+	}
+
+	diskread(&jh, jstart);
+	if (SWAPL(jh.jh_magic) != SFS_JMAGIC) {
+		warnx("Journal header invalid (fixed)");
+		setbadness(EXIT_RECOV);
+		bzero(zeros, sizeof(zeros));
+		diskwrite(zeros, jstart+1);
+		writejheader(1);
+		return;
+	}
+	seq = SWAPL(jh.jh_seq);
+
+	images = domalloc(SFS_JMAXTX * SFS_BLOCKSIZE);
+
+	for (off = 1; off + 2 <= jblocks; off += n + 2) {
+		diskread(&jd, jstart+off);
+		n = SWAPL(jd.jd_nblocks);
+		if (SWAPL(jd.jd_magic) != SFS_JDESC_MAGIC ||
+		    SWAPL(jd.jd_seq) != seq ||
+		    n == 0 || n > SFS_JMAXTX || off + n + 2 > jblocks) {
+			break;
+		}
+
+		sum = 0;
+		for (i=0; i<n; i++) {
+			diskread(images + i*(SFS_BLOCKSIZE/4), jstart+off+1+i);
+			for (k=0; k<SFS_BLOCKSIZE/4; k++) {
+				sum += SWAPL(images[i*(SFS_BLOCKSIZE/4) + k]);
+			}
+		}
+		diskread(&jc, jstart+off+1+n);
+		if (SWAPL(jc.jc_magic) != SFS_JCOMMIT_MAGIC ||
+		    SWAPL(jc.jc_seq) != seq ||
+		    SWAPL(jc.jc_nblocks) != n ||
+		    SWAPL(jc.jc_sum) != sum) {
+			/* Never finished committing; ignore it */
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			block = SWAPL(jd.jd_blocks[i]);
+			if (block == SFS_SB_LOCATION || block >= nblocks ||
+			    (block >= jstart && block < jstart+jblocks)) {
+				break;
+			}
+		}
+		if (i < n) {
+			warnx("Journal transaction %lu has invalid block %lu "
+			      "(transaction dropped)", (unsigned long) seq,
+			      (unsigned long) block);
+			setbadness(EXIT_RECOV);
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			diskwrite(images + i*(SFS_BLOCKSIZE/4),
+				  SWAPL(jd.jd_blocks[i]));
+		}
+		seq++;
+		ntx++;
+	}
+
+	free(images);
+
+	if (ntx > 0) {
+		warnx("Replayed %u journal transaction%s (fixed)", ntx,
+		      ntx == 1 ? "" : "s");
+		setbadness(EXIT_RECOV);
+
+		/*
+		 * Empty the journal. Whatever we stopped at, and
+		 * anything past it, is numbered too low to ever
+		 * match a later transaction.
+		 */
+		writejheader(seq);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -966,6 +1109,114 @@ check_dir_entry(const char *pathsofar, uint32_t index, struct sfs_dir *sfd)
 
 ////////////////////////////////////////////////////////////
 
+/* Hash function for hashed directories; see kern/sfs.h */
+static
+uint32_t
+dirhash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+
+	while (*name) {
+		h = SFS_DIRHASH_STEP(h, *name);
+		name++;
+	}
+	return h;
+}
+
+/* Bucket for hash H with NBUCKETS buckets (linear hashing; see kern/sfs.h) */
+static
+uint32_t
+dirbucket(uint32_t h, uint32_t nbuckets)
+{
+	uint32_t m, b;
+
+	for (m = 1; m <= nbuckets/2; m *= 2) {
+		/* nothing */
+	}
+	b = h % (2*m);
+	if (b >= nbuckets) {
+		b = h % m;
+	}
+	return b;
+}
+
+/*
+ * Check that every entry in the bucket area of a hashed directory is
+ * in the right bucket. Misplaced entries are moved to a free slot in
+ * the right bucket or in the overflow area. If there's no room, or
+ * the directory is too small to hold its buckets, drop the index; a
+ * hashed directory is always also a valid plain directory.
+ *
+ * Returns nonzero if the inode was modified. Sets *DCHANGEDP if the
+ * directory entries were modified.
+ */
+static
+int
+check_dir_buckets(const char *pathsofar, struct sfs_inode *sfi,
+		  struct sfs_dir *d, uint32_t *ndp, uint32_t maxd,
+		  int *dchangedp)
+{
+	const uint32_t atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	uint32_t nbuckets = sfi->sfi_dirbuckets;
+	uint32_t i, j, want;
+	int ichanged = 0;
+
+	if (*ndp < nbuckets*atonce) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory /%s: Too small for %lu hash buckets "
+		      "(index removed)", pathsofar, (unsigned long) nbuckets);
+		sfi->sfi_dirbuckets = 0;
+		return 1;
+	}
+
+	for (i=0; i<nbuckets*atonce; i++) {
+		if (d[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		want = dirbucket(dirhash(d[i].sfd_name), nbuckets);
+		if (want == i/atonce) {
+			continue;
+		}
+
+		/* Find a free slot in the right bucket, or else overflow */
+		for (j=want*atonce; j<(want+1)*atonce; j++) {
+			if (d[j].sfd_ino == SFS_NOINO) {
+				break;
+			}
+		}
+		if (j == (want+1)*atonce) {
+			for (j=nbuckets*atonce; j<maxd; j++) {
+				if (d[j].sfd_ino == SFS_NOINO) {
+					break;
+				}
+			}
+		}
+		if (j == maxd) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory /%s: Entry %s in wrong hash bucket, "
+			      "no room to move it (index removed)",
+			      pathsofar, d[i].sfd_name);
+			sfi->sfi_dirbuckets = 0;
+			return 1;
+		}
+
+		setbadness(EXIT_RECOV);
+		warnx("Directory /%s: Entry %s in wrong hash bucket (moved)",
+		      pathsofar, d[i].sfd_name);
+		d[j] = d[i];
+		d[i].sfd_ino = SFS_NOINO;
+		bzero(d[i].sfd_name, sizeof(d[i].sfd_name));
+		*dchangedp = 1;
+
+		if (j >= *ndp) {
+			*ndp = j+1;
+			sfi->sfi_size = *ndp * sizeof(struct sfs_dir);
+			ichanged = 1;
+		}
+	}
+	return ichanged;
+}
+
 static
 int
 check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
@@ -1149,6 +1400,16 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 
 			switch (subsfi.sfi_type) {
 			    case SFS_TYPE_FILE:
+				if (subsfi.sfi_dirbuckets != 0) {
+					setbadness(EXIT_RECOV);
+					warnx("File /%s has directory hash "
+					      "buckets (fixed)", path);
+					subsfi.sfi_dirbuckets = 0;
+					swapinode(&subsfi);
+					diskwrite(&subsfi,
+						  direntries[i].sfd_ino);
+					swapinode(&subsfi);
+				}
 				if (check_inode_blocks(direntries[i].sfd_ino,
 						       &subsfi, 0)) {
 					swapinode(&subsfi);
@@ -1185,6 +1446,14 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		}
 	}
 
+	if (sfi.sfi_dirbuckets != 0) {
+		if (check_dir_buckets(pathsofar, &sfi, direntries,
+				      &ndirentries, maxdirentries,
+				      &dchanged)) {
+			ichanged = 1;
+		}
+	}
+
 	if (sfi.sfi_linkcount != subdircount+2) {
 		setbadness(EXIT_RECOV);
 		warnx("Directory /%s: Link count %lu should be %lu (fixed)",
@@ -1258,6 +1527,7 @@ main(int argc, char **argv)
 	opendisk(argv[1]);
 
 	check_sb();
+	check_journal();
 	check_root_dir();
 	check_bitmap();
 	adjust_filelinks();
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * sleeptest - check that nanosleep never returns early.
+ *
+ * Sleeps for a range of times, from a single nanosecond to over a
+ * second, and measures each sleep with __time. The elapsed time must
+ * be at least what was asked for. Also checks that rem comes back
+ * zero and that a bad tv_nsec is rejected with EINVAL.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+static const struct {
+	time_t sec;
+	long nsec;
+} requests[] = {
+	{ 0, 0 },
+	{ 0, 1 },
+	{ 0, 9999999 },
+	{ 0, 10000000 },
+	{ 0, 15000000 },
+	{ 0, 250000000 },
+	{ 1, 200000000 },
+};
+
+#define NREQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+static
+long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (long long)secs * 1000000000 + nsecs;
+}
+
+int
+main(void)
+{
+	struct timespec req, rem;
+	long long start, elapsed, want;
+	unsigned i;
+
+	for (i=0; i<NREQUESTS; i++) {
+		req.tv_sec = requests[i].sec;
+		req.tv_nsec = requests[i].nsec;
+		rem.tv_sec = 1;
+		rem.tv_nsec = 1;
+		want = (long long)req.tv_sec * 1000000000 + req.tv_nsec;
+
+		start = now();
+		if (nanosleep(&req, &rem) < 0) {
+			err(1, "nanosleep %lld ns", want);
+		}
+		elapsed = now() - start;
+
+		if (elapsed < want) {
+			errx(1, "nanosleep %lld ns: woke after %lld ns",
+			     want, elapsed);
+		}
+		if (rem.tv_sec != 0 || rem.tv_nsec != 0) {
+			errx(1, "nanosleep %lld ns: rem not zero", want);
+		}
+		printf("sleeptest: asked %lld ns, slept %lld ns\n",
+		       want, elapsed);
+	}
+
+	req.tv_sec = 0;
+	req.tv_nsec = 1000000000;
+	if (nanosleep(&req, NULL) >= 0 || errno != EINVAL) {
+		errx(1, "nanosleep with tv_nsec out of range: expected EINVAL");
+	}
+
+	printf("sleeptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026
+ *	The OS/161 kernel contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of other
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * vectorio - exercise writev on the console.
+ *
+ * Writes one line through writev from several pieces, checks the
+ * returned byte count, and then checks that an empty iovec array
+ * is rejected with EINVAL.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/uio.h>
+
+int
+main(void)
+{
+	static char p1[] = "vectorio: ";
+	static char p2[] = "gathered ";
+	static char p3[] = "";
+	static char p4[] = "write\n";
+	struct iovec iov[4];
+	int r, expected;
+
+	iov[0].iov_base = p1;
+	iov[0].iov_len = strlen(p1);
+	iov[1].iov_base = p2;
+	iov[1].iov_len = strlen(p2);
+	iov[2].iov_base = p3;
+	iov[2].iov_len = 0;
+	iov[3].iov_base = p4;
+	iov[3].iov_len = strlen(p4);
+	expected = strlen(p1) + strlen(p2) + strlen(p4);
+
+	r = writev(STDOUT_FILENO, iov, 4);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if (r != expected) {
+		errx(1, "writev: wrote %d bytes, expected %d", r, expected);
+	}
+
+	r = writev(STDOUT_FILENO, iov, 0);
+	if (r >= 0 || errno != EINVAL) {
+		errx(1, "writev with no buffers: expected EINVAL");
+	}
+
+	printf("vectorio: passed\n");
+	return 0;
+}